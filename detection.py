@@ -16,6 +16,7 @@ calib_file = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/calibration
 led_status_file = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/led_status.txt"
 x_status_file = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/x_status"
 z_status_file = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/z_status"
+approach_status_file = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/approach_status"
 robot_mode = "/home/apriltagtester01/rmr-tagdetection/test_find_tags/robot_mode"
 
 # ===== Logging Setup =====
@@ -108,6 +109,15 @@ def write_z_status(state: str):
     except Exception as e:
         logging.error("something's wrong (z): " + str(e))
         
+# distance to the robot waiting zone, only written while approaching it
+def write_approach_status(state: str):
+    try:
+        with open(approach_status_file, 'w') as f:
+            f.write(state)
+
+    except Exception as e:
+        logging.error("something's wrong (approach): " + str(e))
+        
 def read_mode():
     try:
         with open(robot_mode, 'r') as f:
@@ -223,6 +233,7 @@ try:
                     tag_detection()
                     if z >= 0.50:
                         write_z_status(str(z_average - 50))
+                        write_approach_status(str(z_average - 50))
                         logging.info(str(z_average - 50))
                     if z < 0.50:
                         write_z_status("entered1")
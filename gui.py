@@ -21,6 +21,7 @@ import logging
 logins_txt = '/home/apriltagtester01/rmr-tagdetection/login5'
 x_path = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/x_status'
 z_path = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/z_status'
+approach_path = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/approach_status'
 det_script = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/run.sh'
 robot_mode = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/robot_mode'
 #floor_request_file = '/home/apriltagtester01/rmr-tagdetection/test_find_tags/floor_request_file'
@@ -108,6 +109,7 @@ def login_page():
 
 last_x = None
 last_z = None
+last_approach = None
 prc = None
 prc_pid = 0
         
@@ -184,6 +186,12 @@ def robot_status_page():
         os.killpg(prc_pid, signal.SIGKILL)
             
     def entry_mode():
+        global last_approach
+        # a distance left over from the previous approach is not published
+        try:
+            last_approach = os.path.getmtime(approach_path)
+        except OSError:
+            last_approach = None
         try:
             with open(robot_mode, 'w') as f:
                 f.write("ENTRY")
@@ -221,12 +229,34 @@ def robot_status_page():
                 client.publish("robot/robot-in", new_z, qos=1)
             elif new_z == "entered2":
                 arrived2()
+                client.publish("robot/robot-in", new_z, qos=1)
+            elif new_z == "exited":
+                not_arrived()
+                client.publish("robot/robot-in", new_z, qos=1)
             else:
                 not_arrived()
+        publish_approach(last_x)
         
                 
         root.after(500, update_value)
     
+    # distance to robot waiting zone, lets ESP32 time the lift call. Only
+    # detection.py's ENTRY mode writes it (tag 36, minus the zone offset);
+    # z_status also carries tag 25 and EXIT mode distances.
+    def publish_approach(x):
+        global last_approach
+        try:
+            updated = os.path.getmtime(approach_path)
+            if updated == last_approach:
+                return
+            last_approach = updated
+            with open(approach_path, 'r') as file:
+                z_cm = float(file.readline())
+            x_cm = float(x)
+        except (OSError, TypeError, ValueError):
+            return
+        client.publish("robot/approach", str(z_cm) + "," + str(x_cm), qos=0)
+
     def arrived():
         update_btn.place(x=15, y=65)
         update2_btn.place_forget()
@@ -0,0 +1,242 @@
+#ifndef LIFT_STATE_MACHINE_H
+#define LIFT_STATE_MACHINE_H
+
+// Lift cycle state machine: states, events, the transition table, the
+// panel notices and the event queue. No Arduino dependencies, so
+// test/test_state_machine.cpp can drive it on the host.
+
+#include "lora_link.h"
+
+// Lift cycle states, in the order of sequence_diagram.md
+enum RobotStatus {
+  IDLE,
+  FLOOR_REQUEST_SUCCESS, // waiting for the pre-call to become due
+  CALLING_ELEVATOR,      // LoRa call to panel in progress
+  ELEVATOR_CONFIRMED,    // panel ACKed, lift and robot on their way
+  ROBOT_WAIT,            // robot at waiting zone, lift not there yet
+  ELEVATOR_ARRIVED,      // lift at pickup floor, robot entering
+  ROBOT_IN,              // robot inside, panel closing the door
+  TRAVELLING,            // lift moving to target floor
+  ELEVATOR_AT_TARGET,    // lift at target floor, robot exiting
+  ROBOT_OUT,             // robot out, telling panel
+  COMMUNICATION_ERROR,
+  NUM_STATUSES
+};
+
+// Events from HTTP, MQTT, LoRa, GPIO and timers
+enum RobotEvent {
+  EV_FLOOR_REQUEST,  // HTTP: target floor selected
+  EV_CALL_DUE,       // pre-call policy says call now
+  EV_PANEL_ACKED,    // LoRa: panel ACKed our last message
+  EV_PANEL_FAILED,   // LoRa: no ACK after all retries
+  EV_ROBOT_AT_RWZ,   // MQTT: robot at waiting zone
+  EV_LIFT_AT_PICKUP, // LoRa: lift reported at current floor
+  EV_ROBOT_ENTERED,  // MQTT: robot inside lift
+  EV_LIFT_MOVING,    // LoRa: lift reported at another floor
+  EV_LIFT_AT_TARGET, // LoRa: lift reported at target floor
+  EV_ROBOT_EXITED,   // MQTT: robot left the lift
+  EV_TIMEOUT,        // state stayed longer than its timeout
+  EV_TAG_REACQUIRED, // GPIO: tag seen again after a dropout, see pinEvent()
+  NUM_EVENTS
+};
+
+struct Transition {
+  RobotStatus from;
+  RobotEvent event;
+  RobotStatus to;
+};
+
+// Events not listed for a state are ignored
+constexpr Transition transitionTable[] = {
+    {IDLE, EV_FLOOR_REQUEST, FLOOR_REQUEST_SUCCESS},
+    {FLOOR_REQUEST_SUCCESS, EV_CALL_DUE, CALLING_ELEVATOR},
+    {FLOOR_REQUEST_SUCCESS, EV_ROBOT_AT_RWZ, CALLING_ELEVATOR},
+    {FLOOR_REQUEST_SUCCESS, EV_TIMEOUT, CALLING_ELEVATOR},
+    {CALLING_ELEVATOR, EV_PANEL_ACKED, ELEVATOR_CONFIRMED},
+    {CALLING_ELEVATOR, EV_PANEL_FAILED, COMMUNICATION_ERROR},
+    {ELEVATOR_CONFIRMED, EV_ROBOT_AT_RWZ, ROBOT_WAIT},
+    {ELEVATOR_CONFIRMED, EV_LIFT_AT_PICKUP, ELEVATOR_ARRIVED},
+    {ELEVATOR_CONFIRMED, EV_ROBOT_ENTERED, ROBOT_IN},
+    {ELEVATOR_CONFIRMED, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {ROBOT_WAIT, EV_LIFT_AT_PICKUP, ELEVATOR_ARRIVED},
+    {ROBOT_WAIT, EV_ROBOT_ENTERED, ROBOT_IN},
+    {ROBOT_WAIT, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {ELEVATOR_ARRIVED, EV_ROBOT_ENTERED, ROBOT_IN},
+    {ELEVATOR_ARRIVED, EV_TAG_REACQUIRED, ROBOT_IN},
+    {ELEVATOR_ARRIVED, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {ROBOT_IN, EV_LIFT_MOVING, TRAVELLING},
+    {ROBOT_IN, EV_LIFT_AT_TARGET, ELEVATOR_AT_TARGET},
+    {ROBOT_IN, EV_ROBOT_EXITED, ROBOT_OUT},
+    {ROBOT_IN, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {TRAVELLING, EV_LIFT_AT_TARGET, ELEVATOR_AT_TARGET},
+    {TRAVELLING, EV_ROBOT_EXITED, ROBOT_OUT},
+    {TRAVELLING, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {ELEVATOR_AT_TARGET, EV_ROBOT_EXITED, ROBOT_OUT},
+    {ELEVATOR_AT_TARGET, EV_TIMEOUT, COMMUNICATION_ERROR},
+    {ROBOT_OUT, EV_PANEL_ACKED, IDLE},
+    {ROBOT_OUT, EV_PANEL_FAILED, IDLE},
+    {COMMUNICATION_ERROR, EV_TIMEOUT, IDLE},
+};
+constexpr int NUM_TRANSITIONS = sizeof(transitionTable) / sizeof(Transition);
+
+// Per-state timeout in ms, indexed by RobotStatus (0 = no timeout)
+constexpr unsigned long stateTimeoutMs[] = {
+    0,      // IDLE
+    120000, // FLOOR_REQUEST_SUCCESS, give up predicting and call
+    0,      // CALLING_ELEVATOR, bounded by the retry loop
+    180000, // ELEVATOR_CONFIRMED
+    120000, // ROBOT_WAIT
+    60000,  // ELEVATOR_ARRIVED
+    60000,  // ROBOT_IN
+    120000, // TRAVELLING
+    60000,  // ELEVATOR_AT_TARGET
+    0,      // ROBOT_OUT, bounded by the retry loop
+    5000,   // COMMUNICATION_ERROR, show the error then reset
+};
+
+// Short state names used in logs and /metrics
+constexpr const char *stateNames[] = {
+    "idle",   "pending",    "call",   "arrive", "wait",  "enter",
+    "door_close", "travel", "exit",   "exited", "error",
+};
+
+constexpr const char *eventNames[] = {
+    "floor_request", "call_due",    "panel_acked",    "panel_failed",
+    "robot_at_rwz",  "lift_at_pickup", "robot_entered", "lift_moving",
+    "lift_at_target", "robot_exited", "timeout",       "tag_reacquired",
+};
+
+// Compile-time checks of the tables above
+constexpr bool sameKey(const Transition &a, const Transition &b) {
+  return a.from == b.from && a.event == b.event;
+}
+constexpr bool keyUniqueAfter(int i, int j) {
+  return j >= NUM_TRANSITIONS
+             ? true
+             : !sameKey(transitionTable[i], transitionTable[j]) &&
+                   keyUniqueAfter(i, j + 1);
+}
+constexpr bool transitionsUnique(int i = 0) {
+  return i >= NUM_TRANSITIONS
+             ? true
+             : keyUniqueAfter(i, i + 1) && transitionsUnique(i + 1);
+}
+constexpr bool hasTransition(int state, RobotEvent event, int i = 0) {
+  return i >= NUM_TRANSITIONS
+             ? false
+             : (transitionTable[i].from == state &&
+                transitionTable[i].event == event) ||
+                   hasTransition(state, event, i + 1);
+}
+constexpr bool timeoutsHandled(int state = 0) {
+  return state >= NUM_STATUSES
+             ? true
+             : (stateTimeoutMs[state] == 0 ||
+                hasTransition(state, EV_TIMEOUT)) &&
+                   timeoutsHandled(state + 1);
+}
+static_assert(sizeof(stateTimeoutMs) / sizeof(stateTimeoutMs[0]) ==
+                  NUM_STATUSES,
+              "stateTimeoutMs must have one entry per RobotStatus");
+static_assert(sizeof(stateNames) / sizeof(stateNames[0]) == NUM_STATUSES,
+              "stateNames must have one entry per RobotStatus");
+static_assert(sizeof(eventNames) / sizeof(eventNames[0]) == NUM_EVENTS,
+              "eventNames must have one entry per RobotEvent");
+static_assert(transitionsUnique(),
+              "transitionTable has two entries for the same state and event");
+static_assert(timeoutsHandled(),
+              "every state with a timeout needs an EV_TIMEOUT transition");
+
+// Look up the transition for an event; false if the event is ignored
+inline bool findTransition(RobotStatus from, RobotEvent event,
+                           RobotStatus &to) {
+  for (int i = 0; i < NUM_TRANSITIONS; i++) {
+    if (transitionTable[i].from == from && transitionTable[i].event == event) {
+      to = transitionTable[i].to;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether a state with a timeout has been in it long enough
+inline bool stateTimedOut(RobotStatus status, unsigned long elapsedMs) {
+  unsigned long timeout = stateTimeoutMs[status];
+  return timeout > 0 && elapsedMs >= timeout;
+}
+
+// LoRa message (MSG_*) the panel has to get after entering a state.
+// States without their own notice keep the one still pending, so a retried
+// "robot entered" survives the lift starting to move.
+const int NO_NOTICE = -1;
+inline int noticeOnEntry(RobotStatus next, int pending) {
+  switch (next) {
+  case CALLING_ELEVATOR:
+    return MSG_REQUEST;
+  case ROBOT_IN:
+    return MSG_ROBOT_ENTERED;
+  case ROBOT_OUT:
+    return MSG_ROBOT_EXITED;
+  case COMMUNICATION_ERROR:
+    return NO_NOTICE;
+  default:
+    return pending;
+  }
+}
+
+// What a delivered or failed notice does. A lost "robot entered" must not
+// end a trip while the robot is still riding the lift, so in ROBOT_IN it
+// is retried until the panel ACKs it; the state timeout still bounds it.
+enum NoticeOutcome { NOTICE_ACKED, NOTICE_RETRY, NOTICE_FAILED };
+inline NoticeOutcome noticeOutcome(RobotStatus status, bool acked) {
+  if (acked) {
+    return NOTICE_ACKED;
+  }
+  return status == ROBOT_IN ? NOTICE_RETRY : NOTICE_FAILED;
+}
+
+// The Pi's GPIO line follows detection.py's LED: HIGH while any AprilTag
+// is within 4 m of the camera. That already happens on the approach, so
+// the line means "near the lift", not "inside". Only a rising edge after
+// the robot reported the waiting zone is passed on: the robot waits there
+// in view of the tag, so the line drops only when it drives in and the
+// entrance tag leaves the view, and rises again on the tag in the car. The
+// table takes that as entering only with the lift open at the pickup floor
+// (ELEVATOR_ARRIVED). Falling edges also happen mid-ride and are ignored;
+// exiting is reported over MQTT.
+inline bool pinEvent(bool high, bool robotAtRwz, RobotEvent &event) {
+  if (!high || !robotAtRwz) {
+    return false;
+  }
+  event = EV_TAG_REACQUIRED;
+  return true;
+}
+
+// Fixed-size FIFO of events, one slot is kept free to tell full from empty
+const int EVENT_QUEUE_SIZE = 16;
+struct EventQueue {
+  RobotEvent events[EVENT_QUEUE_SIZE];
+  int head;
+  int tail;
+
+  bool push(RobotEvent event) {
+    int next = (tail + 1) % EVENT_QUEUE_SIZE;
+    if (next == head) {
+      return false;
+    }
+    events[tail] = event;
+    tail = next;
+    return true;
+  }
+
+  bool pop(RobotEvent &event) {
+    if (head == tail) {
+      return false;
+    }
+    event = events[head];
+    head = (head + 1) % EVENT_QUEUE_SIZE;
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef LORA_LINK_H
+#define LORA_LINK_H
+
+// LoRa frame format shared with the panel, and the duplicate suppression
+// both ends run on it. No Arduino dependencies, so test/test_lora_link.cpp
+// can drive it on the host.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary message types (Message.ack)
+#define MSG_REQUEST 0
+#define MSG_ACK 1
+#define MSG_LIFT_REPORT 2
+#define MSG_ROBOT_ENTERED 3
+#define MSG_ROBOT_EXITED 4
+#define MSG_PROFILE_SWITCH 5 // targetFloor = radio profile to retune to
+
+// Node ids (Message.src / Message.dst)
+#define ROBOT_NODE_ID 1
+#define PANEL_NODE_ID 2
+#define BROADCAST_NODE_ID 0xFF
+
+// Binary message structure
+struct Message {
+  uint8_t ack; // message type, see MSG_*
+  uint8_t src; // sending node
+  uint8_t dst; // receiving node, ACKs go back to the sender
+  uint16_t boot;   // sender's boot id, random on every power-up
+  uint16_t seqNum; // per sender, the same for every retry of a message
+  uint8_t currentFloor;
+  uint8_t targetFloor;
+  uint32_t timestamp;
+} __attribute__((packed));
+
+// An ACK echoes the boot id and seqNum of the frame it confirms
+inline Message makeAck(const Message &frame, uint8_t self) {
+  Message ack = frame;
+  ack.ack = MSG_ACK;
+  ack.src = self;
+  ack.dst = frame.src;
+  return ack;
+}
+
+// Replay cache: (src, boot, seqNum) of frames already acted on, with the
+// ACK we answered. seqNum restarts after a reboot, the boot id keeps the
+// new frames from matching entries of the previous boot.
+const int REPLAY_CACHE_SIZE = 8;
+struct ReplayEntry {
+  bool valid;
+  uint8_t src;
+  uint16_t boot;
+  uint16_t seqNum;
+  Message ack;
+};
+
+struct ReplayCache {
+  ReplayEntry entries[REPLAY_CACHE_SIZE];
+  int next;
+
+  // Cached ACK for a frame we already acted on, NULL if it is new
+  const Message *find(const Message &frame) const {
+    for (int i = 0; i < REPLAY_CACHE_SIZE; i++) {
+      const ReplayEntry &entry = entries[i];
+      if (entry.valid && entry.src == frame.src && entry.boot == frame.boot &&
+          entry.seqNum == frame.seqNum) {
+        return &entry.ack;
+      }
+    }
+    return NULL;
+  }
+
+  // Remember the ACK sent for a frame, oldest entry is replaced
+  void store(const Message &frame, const Message &ack) {
+    ReplayEntry &entry = entries[next];
+    entry.valid = true;
+    entry.src = frame.src;
+    entry.boot = frame.boot;
+    entry.seqNum = frame.seqNum;
+    entry.ack = ack;
+    next = (next + 1) % REPLAY_CACHE_SIZE;
+  }
+};
+
+// Newest frame acted on from one sender. A frame behind it arrived out of
+// order and is ACKed without acting. A new boot id means the sender
+// restarted its seqNum, so ordering starts over.
+struct FrameOrder {
+  bool valid;
+  uint16_t boot;
+  uint16_t lastSeq;
+
+  // true if the frame is newer than everything seen, and records it
+  bool accept(const Message &frame) {
+    if (valid && frame.boot == boot &&
+        (int16_t)(frame.seqNum - lastSeq) < 0) {
+      return false;
+    }
+    valid = true;
+    boot = frame.boot;
+    lastSeq = frame.seqNum;
+    return true;
+  }
+};
+
+enum FrameClass {
+  FRAME_OWN,        // our own transmission
+  FRAME_FOREIGN,    // from another node, or addressed to another node
+  FRAME_ACK,        // ACK for the message we are waiting on
+  FRAME_LATE_ACK,   // ACK for an earlier message or an earlier boot
+  FRAME_DATA,       // any other frame from our peer, needs an ACK
+};
+
+// Sort a received frame. boot and seqNum identify the message we are
+// waiting on an ACK for. Only traffic from or to other nodes counts as
+// foreign, a late ACK from our peer is a duplicate.
+inline FrameClass classifyFrame(const Message &frame, uint8_t self,
+                                uint8_t peer, uint16_t boot, uint16_t seqNum) {
+  if (frame.src == self) {
+    return FRAME_OWN;
+  }
+  if (frame.src != peer ||
+      (frame.dst != self && frame.dst != BROADCAST_NODE_ID)) {
+    return FRAME_FOREIGN;
+  }
+  if (frame.ack == MSG_ACK) {
+    return frame.boot == boot && frame.seqNum == seqNum ? FRAME_ACK
+                                                        : FRAME_LATE_ACK;
+  }
+  return FRAME_DATA;
+}
+
+#endif
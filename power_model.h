@@ -0,0 +1,80 @@
+#ifndef POWER_MODEL_H
+#define POWER_MODEL_H
+
+// LoRa airtime and the duty-cycled receive used in power save. No Arduino
+// dependencies, so test/test_power_model.cpp can model the latency and
+// energy trade-off on the host.
+
+#include <math.h>
+#include <stdint.h>
+
+const uint16_t DEFAULT_PREAMBLE = 8;
+const uint16_t RX_MIN_SYMBOLS = 8;       // preamble symbols needed to detect
+const long MAX_PREAMBLE_SYMBOLS = 65535; // SX1262 preamble length register
+const unsigned long WAKE_POLL_MS = 10;   // loop wait checks for a frame this often
+
+inline float loraSymbolMs(uint8_t sf, float bwKHz) {
+  return (float)(1UL << sf) / bwKHz;
+}
+
+// Time on air from the SX1261/2 datasheet (section 6.1.4), explicit header
+// and CRC on, low data rate optimization when a symbol is over 16 ms
+inline float loraAirtimeMs(uint8_t sf, float bwKHz, uint8_t cr,
+                           long preambleSymbols, int payloadBytes) {
+  float symbolMs = loraSymbolMs(sf, bwKHz);
+  int ldro = symbolMs > 16.0 ? 1 : 0;
+  float preamble;
+  int bits;
+  int bitsPerSymbol;
+  if (sf < 7) {
+    preamble = preambleSymbols + 6.25;
+    bits = 8 * payloadBytes + 16 - 4 * sf + 20;
+    bitsPerSymbol = 4 * sf;
+  } else {
+    preamble = preambleSymbols + 4.25;
+    bits = 8 * payloadBytes + 16 - 4 * sf + 8 + 20;
+    bitsPerSymbol = 4 * (sf - 2 * ldro);
+  }
+  int blocks = bits > 0 ? (bits + bitsPerSymbol - 1) / bitsPerSymbol : 0;
+  float payload = 8 + blocks * cr;
+  return (preamble + payload) * symbolMs;
+}
+
+// Preamble the panel has to send unsolicited reports with so the robot
+// catches them in duty-cycle receive. The loop takes up to WAKE_POLL_MS to
+// notice a received frame, so the extra preamble gets the rest of
+// maxWakeLatencyMs. Not clamped, callers reject configs above
+// MAX_PREAMBLE_SYMBOLS.
+inline long wakePreambleSymbols(uint8_t sf, float bwKHz,
+                                unsigned long maxWakeLatencyMs) {
+  unsigned long budgetMs = maxWakeLatencyMs > WAKE_POLL_MS
+                               ? maxWakeLatencyMs - WAKE_POLL_MS
+                               : 0;
+  return DEFAULT_PREAMBLE + (long)(budgetMs / loraSymbolMs(sf, bwKHz));
+}
+
+// Duty-cycle receive windows for a sender preamble. Wake for
+// 2 * RX_MIN_SYMBOLS and sleep for the rest of a preamble minus
+// RX_MIN_SYMBOLS, so a preamble that just misses one window still has
+// enough symbols left when the next one opens. false if the preamble is too
+// short to sleep at least as long as each window listens; waking that often
+// saves little over staying in RX.
+inline bool dutyCycleWindows(long preambleSymbols, float symbolMs,
+                             float &rxMs, float &sleepMs) {
+  if (preambleSymbols < 5 * RX_MIN_SYMBOLS) {
+    return false;
+  }
+  rxMs = 2 * RX_MIN_SYMBOLS * symbolMs;
+  sleepMs = (preambleSymbols - 3 * RX_MIN_SYMBOLS) * symbolMs;
+  return true;
+}
+
+// Expected receiver-on time for a frame caught in duty-cycle receive. The
+// window that detects the preamble opens on average half a cycle after it
+// starts, and the receiver then stays on to the end of the frame.
+inline float caughtFrameOnMs(float frameAirtimeMs, float rxMs, float sleepMs) {
+  float onMs = frameAirtimeMs - (rxMs + sleepMs) / 2;
+  return onMs > rxMs ? onMs : rxMs;
+}
+
+#endif
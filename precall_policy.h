@@ -0,0 +1,100 @@
+#ifndef PRECALL_POLICY_H
+#define PRECALL_POLICY_H
+
+// Predictive pre-call policy. Decides when to send the LoRa lift call from
+// the robot's approach telemetry and the lift's ETA. No Arduino
+// dependencies, so test/test_precall.cpp can simulate it on the host.
+
+#include <math.h>
+#include <stdlib.h>
+
+struct PreCallTuning {
+  float approachSpeedCmPerSec;        // used until a speed is measured
+  unsigned long liftTravelPerFloorMs; // lift travel time per floor
+  unsigned long liftDoorOpenMs;       // lift stop + door open time
+  unsigned long marginMs;             // call this much earlier than needed
+  unsigned long staleMs;              // no update -> call immediately
+};
+
+const PreCallTuning DEFAULT_PRECALL_TUNING = {15.0, 3000, 3000, 1000, 3000};
+
+// Distance to the robot waiting zone, from the Pi's "z_cm,x_cm" telemetry
+struct ApproachTracker {
+  float distanceCm;    // -1 = no telemetry this trip
+  float speedEstimate; // cm/s, 0 = not measured yet
+  unsigned long lastUpdate;
+  float startDistanceCm; // first sample of the current approach
+  unsigned long startTime;
+};
+
+inline void approachReset(ApproachTracker &t) {
+  t.distanceCm = -1;
+  t.speedEstimate = 0;
+  t.lastUpdate = 0;
+  t.startDistanceCm = -1;
+  t.startTime = 0;
+}
+
+inline bool approachFresh(const ApproachTracker &t, unsigned long now,
+                          const PreCallTuning &tuning) {
+  return t.distanceCm >= 0 && now - t.lastUpdate <= tuning.staleMs;
+}
+
+inline void approachUpdate(ApproachTracker &t, float z, float x,
+                           unsigned long now, const PreCallTuning &tuning) {
+  if (z < 0) {
+    z = 0;
+  }
+  float distance = sqrtf(z * z + x * x);
+
+  // Average speed since the approach started. Sample-to-sample speeds are
+  // dominated by the camera's distance noise and make the call fire early.
+  if (!approachFresh(t, now, tuning)) {
+    t.speedEstimate = 0;
+    t.startDistanceCm = distance;
+    t.startTime = now;
+  } else {
+    float dt = (now - t.startTime) / 1000.0;
+    if (dt >= 1.0) {
+      float speed = (t.startDistanceCm - distance) / dt;
+      t.speedEstimate = speed > 0 ? speed : 0;
+    }
+  }
+  t.distanceCm = distance;
+  t.lastUpdate = now;
+}
+
+// Time until the robot reaches the waiting zone
+inline unsigned long robotEtaMs(const ApproachTracker &t, unsigned long now,
+                                const PreCallTuning &tuning) {
+  if (t.distanceCm < 0) {
+    return 0;
+  }
+  float speed =
+      t.speedEstimate > 0 ? t.speedEstimate : tuning.approachSpeedCmPerSec;
+  unsigned long elapsed = now - t.lastUpdate;
+  unsigned long eta = (unsigned long)(t.distanceCm / speed * 1000.0);
+  return eta > elapsed ? eta - elapsed : 0;
+}
+
+// Time from sending the call until the lift doors are open at our floor.
+// Assumes the worst case distance when the panel hasn't reported the lift.
+inline unsigned long liftEtaMs(int liftFloor, int currentFloor, int maxFloor,
+                               unsigned long airtimeMs,
+                               const PreCallTuning &tuning) {
+  int floors = liftFloor > 0 ? abs(liftFloor - currentFloor) : maxFloor - 1;
+  return airtimeMs + floors * tuning.liftTravelPerFloorMs +
+         tuning.liftDoorOpenMs;
+}
+
+// Whether a held floor request should be sent to the panel now. Without
+// fresh telemetry there is nothing to predict from, so call right away.
+inline bool preCallDue(const ApproachTracker &t, unsigned long now,
+                       unsigned long liftEta, const PreCallTuning &tuning) {
+  if (!approachFresh(t, now, tuning)) {
+    return true;
+  }
+  return robotEtaMs(t, now, tuning) <= liftEta + tuning.marginMs;
+}
+
+#endif
@@ -3,14 +3,19 @@
 #include <RadioLib.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
+#include <Preferences.h>
+#include "precall_policy.h"
+#include "lift_state_machine.h"
+#include "lora_link.h"
+#include "robot_config.h"
+#include "power_model.h"
 
 // WiFi credentials
 const char *ssid = "RobotESP32-Network";
 const char *password = "rmr123456";
 WiFiServer server(80);
 
-// MQTT setup for Pi communication
-const char* mqttBroker = "192.168.4.10";  // Pi's IP when connected to ESP32's network
+// MQTT setup for Pi communication (broker IP lives in config)
 const int mqttPort = 1883;
 const char* mqttClientId = "robot_esp32";
 WiFiClient wifiClient;
@@ -20,11 +25,68 @@ PubSubClient mqttClient(wifiClient);
 const char* topicRobotIn = "robot/robot-in";           // ESP32 subscribes (Pi publishes)
 const char* topicFloorRequest = "robot/floor-request"; // ESP32 publishes (Pi subscribes)
 const char* topicStatus = "robot/status";              // ESP32 publishes (optional)
+const char* topicApproach = "robot/approach";          // ESP32 subscribes (Pi publishes "z_cm,x_cm")
 
 // LoRa setup
 #define LORA_VEXT 3
 SX1262 radio = new Module(8, 14, 12, 13);
-#define LORA_FREQ 920.0
+
+// NVS backed config store, namespace "rmr", key "config"
+class NvsConfigStore : public ConfigStore {
+public:
+  void begin() { prefs.begin("rmr", false); }
+  bool read(RobotConfig &stored) {
+    if (prefs.getBytesLength("config") != sizeof(RobotConfig)) {
+      return false;
+    }
+    return prefs.getBytes("config", &stored, sizeof(RobotConfig)) ==
+           sizeof(RobotConfig);
+  }
+  bool write(const RobotConfig &stored) {
+    return prefs.putBytes("config", &stored, sizeof(RobotConfig)) ==
+           sizeof(RobotConfig);
+  }
+
+private:
+  Preferences prefs;
+} configStore;
+
+RobotConfig config;
+bool tokenGenerated = false; // show the new token once the OLED is up
+int radioProfile = -1;     // profile currently programmed into the radio
+unsigned long abTrips = 0; // trips since boot, picks the A/B profile
+unsigned long nextProfileSwitchAt = 0;
+const unsigned long PROFILE_SWITCH_RETRY_MS = 30000;
+bool radioConfigChanged = false;
+bool mqttServerChanged = false;
+
+// Power save. The panel sends its unsolicited lift reports with a preamble
+// long enough for us to catch while receiving in duty-cycle mode; the extra
+// preamble is what bounds the added wake latency of a report. Our calls and
+// both ends' ACKs keep the short preamble.
+uint16_t reportPreamble = DEFAULT_PREAMBLE; // panel's report preamble
+uint16_t radioPreamble = 0;                 // programmed into the radio
+
+// Energy proxies
+float radioOnFraction = 1.0;          // share of time the receiver is on
+float dutyRxMs = 0;                   // duty-cycle windows, 0 = fully on
+float dutySleepMs = 0;
+unsigned long radioAccountedAt = 0;
+float radioOnMs = 0;
+unsigned long cpuActiveUs = 0;
+unsigned long cpuActiveMs = 0;
+
+// Per-profile performance counters
+struct ProfileStats {
+  uint32_t calls;
+  uint32_t acked;
+  uint32_t failed;
+  uint32_t retries;
+  unsigned long ackLatencyTotalMs;
+  unsigned long ackLatencyMaxMs;
+  unsigned long airtimeMs;
+};
+ProfileStats profileStats[NUM_PROFILES];
 
 // OLED Set up
 #define OLED_SDA 17
@@ -34,56 +96,126 @@ SX1262 radio = new Module(8, 14, 12, 13);
 
 SSD1306Wire display(0x3c, OLED_SDA, OLED_SCL);
 
-// Binary message structure
-struct Message {
-  uint8_t ack;
-  uint16_t seqNum;
-  uint8_t currentFloor;
-  uint8_t targetFloor;
-  uint32_t timestamp;
-} __attribute__((packed));
-
 // Robot state
 int currentFloor = 0;
 int requestedFloor = 0;
 uint16_t seqNum = 0;
-int maxRetries = 5;
+uint16_t bootId = 0; // random per power-up, set in setup()
+
+// Retries reuse seqNum and the receiver answers duplicates from its replay
+// cache without acting again, so the ACK window and backoff (config
+// ackTurnaroundMs / retryBackoffMaxMs) can be short.
+
+// Panel frames already acted on, the panel keeps the same cache for ours
+ReplayCache replayCache = {};
+FrameOrder panelReportOrder = {false, 0, 0};
+
+// LoRa link statistics, ACK latency and retries are in profileStats
+uint32_t duplicateFrameCount = 0;
+uint32_t staleFrameCount = 0;
+uint32_t foreignFrameCount = 0;
 
 // MQTT connection state
 unsigned long lastMQTTAttempt = 0;
-const unsigned long MQTT_RETRY_INTERVAL = 5000;  // Retry every 5 seconds
 unsigned long lastMQTTMessageTime = 0;
 const unsigned long MQTT_MESSAGE_DISPLAY_DURATION = 3000;  // Show message for 3 seconds
+const int MQTT_MAX_PACKETS_PER_LOOP = 32;  // bounds the drain in loop()
+
+// Predictive pre-call: send the LoRa call once the robot's predicted arrival
+// at the waiting zone matches the lift's ETA, instead of right after the
+// floor request is accepted. Enabled and tuned in config.
+const int MAX_FLOOR = 7;
+
+// Approach telemetry from Pi
+ApproachTracker approach = {-1, 0, 0, -1, 0};
+
+// Lift position reported by panel (0 = unknown)
+int liftFloor = 0;
+volatile bool panelFrameReceived = false;
+
+// Pre-call bookkeeping. The call is held back from the floor request
+// until the lift would arrive with the robot; the hold time is lift travel
+// that no longer happens ahead of the robot (lift idling with doors open).
+unsigned long floorRequestTime = 0;
+unsigned long lastHeldBackMs = 0;
+unsigned long totalHeldBackMs = 0;
+int preCallCount = 0;
 
 // Pi connection
-const int inputPin = 47; // GPIO connected to Pi's output
+const int inputPin = 47; // GPIO connected to Pi's output, see pinEvent()
 int lastState = LOW;
-
-enum RobotStatus {
-  IDLE,
-  FLOOR_REQUEST_SUCCESS,
-  CALLING_ELEVATOR,
-  ELEVATOR_CONFIRMED,
-  ROBOT_IN,
-  ROBOT_WAIT,
-  ROBOT_OUT,
-  COMMUNICATION_ERROR
-};
+bool robotAtRwz = false; // Pi reported the waiting zone this trip
 
 RobotStatus robotStatus = IDLE;
+unsigned long stateEnteredAt = 0;
+bool timeoutPosted = false;
+
+// Single event queue, filled by callbacks and pollers, drained in loop()
+EventQueue eventQueue = {{}, 0, 0};
+
+// LoRa message the current state wants delivered to the panel
+int pendingPanelMessage = NO_NOTICE;
+
+// Per-state duration histograms
+const unsigned long PHASE_BUCKET_MS[] = {1000,  2000,  5000, 10000,
+                                         20000, 30000, 60000};
+const int NUM_PHASE_BUCKETS =
+    sizeof(PHASE_BUCKET_MS) / sizeof(PHASE_BUCKET_MS[0]) + 1; // + overflow
+uint16_t phaseHistogram[NUM_STATUSES][NUM_PHASE_BUCKETS];
+uint32_t phaseCount[NUM_STATUSES];
+unsigned long phaseTotalMs[NUM_STATUSES];
+unsigned long phaseMaxMs[NUM_STATUSES];
 
 void handleWebRequests();
 void handleCurrentFloorUpdate(WiFiClient client, String request);
 void handleFloorRequest(WiFiClient client, String request);
 void handleStatusRequest(WiFiClient client);
+void handleMetricsRequest(WiFiClient client);
+void handleConfigRequest(WiFiClient client, String request, String body);
 void sendWebPage(WiFiClient client);
 int extractFloorNumber(String request, String routeType);
-void sendElevatorRequest();
+bool sendElevatorRequest(uint8_t type, uint8_t target);
+bool callPanel(uint8_t type, uint8_t target);
 String statusToString(RobotStatus status);
 bool listenForAck(unsigned long timeoutMs);
-bool robotIn(int inputPin);
+void pollRobotPin(int inputPin);
+
+// State machine functions
+bool postEvent(RobotEvent event);
+void processEvents();
+void dispatchEvent(RobotEvent event);
+void enterState(RobotStatus next);
+void checkStateTimeout();
+void recordPhaseDuration(RobotStatus status, unsigned long durationMs);
+void serviceRadio();
 void updateDisplay(String line1, String line2);
 
+// Configuration functions
+void loadConfig();
+bool saveConfig();
+void applyRadioProfile(int profile);
+bool switchRadioProfile(int profile);
+int transmitFrame(Message &msg);
+bool isAuthorized(String request);
+String configToJson();
+
+// Predictive pre-call functions
+void handleApproachUpdate(const char* message);
+unsigned long estimateLiftEtaMs();
+bool isPreCallDue();
+void startListeningForPanel();
+void accountRadio(float nextFraction);
+void accountCaughtFrame();
+void waitForWork(unsigned long maxMs);
+void setRadioPreamble(uint16_t length);
+void applyPowerMode();
+void pollPanelReports();
+void handleLiftReport(int floor);
+
+// Duplicate suppression
+void handlePanelReport(const Message &report);
+unsigned long ackWindowMs();
+
 // MQTT functions
 void mqttCallback(char* topic, byte* payload, unsigned int length);
 bool connectMQTT();  // Returns true if connected, false if not (non-blocking)
@@ -100,6 +232,15 @@ void updateDisplay(String line1, String line2) {
 
 // MQTT callback - handles messages from Pi
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  // Approach telemetry arrives several times a second, handle it quietly
+  if (strcmp(topic, topicApproach) == 0) {
+    char telemetry[length + 1];
+    memcpy(telemetry, payload, length);
+    telemetry[length] = '\0';
+    handleApproachUpdate(telemetry);
+    return;
+  }
+
   Serial.println("\n========== MQTT CALLBACK TRIGGERED ==========");
   Serial.print("Topic length: ");
   Serial.println(strlen(topic));
@@ -133,15 +274,18 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
     updateDisplay("Received: " + String(message), "");
     
     if (strcmp(message, "entered1") == 0) {
-      robotStatus = ROBOT_WAIT;
+      // Telemetry for this trip is done
+      approachReset(approach);
+      robotAtRwz = true;
+      postEvent(EV_ROBOT_AT_RWZ);
       updateDisplay("Robot at RWZ", "(from Pi via MQTT)");
       Serial.println("→ Robot at RWZ (from Pi via MQTT)"); 
     } else if (strcmp(message, "entered2") == 0) {
-      robotStatus = ROBOT_IN;
+      postEvent(EV_ROBOT_ENTERED);
       updateDisplay("Robot in elevator", "(from Pi via MQTT)");
       Serial.println("→ Robot entered elevator (from Pi via MQTT)"); 
     } else if (strcmp(message, "exited") == 0) {
-      robotStatus = ROBOT_OUT;
+      postEvent(EV_ROBOT_EXITED);
       updateDisplay("Robot exited elevator", "(from Pi via MQTT)");
       Serial.println("→ Robot exited elevator (from Pi via MQTT)");
     } else if (strcmp(message, "positioning") == 0) { 
@@ -169,7 +313,7 @@ bool connectMQTT() {
   }
   
   Serial.print("Connecting to MQTT broker at ");
-  Serial.print(mqttBroker);
+  Serial.print(config.mqttBroker);
   Serial.print(":");
   Serial.print(mqttPort);
   Serial.println("...");
@@ -179,7 +323,7 @@ bool connectMQTT() {
     Serial.print("Client ID: ");
     Serial.println(mqttClientId);
     Serial.print("Broker: ");
-    Serial.print(mqttBroker);
+    Serial.print(config.mqttBroker);
     Serial.print(":");
     Serial.println(mqttPort);
     updateDisplay("MQTT connected", "");
@@ -205,6 +349,11 @@ bool connectMQTT() {
       Serial.println(mqttClient.state());
       updateDisplay("Failed to subscribe", String(topicRobotIn));
     }
+    if (mqttClient.subscribe(topicApproach, 0)) {
+      Serial.println("✓ Subscribed to: " + String(topicApproach) + " (QoS 0)");
+    } else {
+      Serial.println("✗ Failed to subscribe to: " + String(topicApproach));
+    }
     return true;
   } else {
     Serial.print("MQTT connection failed, rc=");
@@ -236,6 +385,274 @@ void sendFloorRequestToPi(int currentFloor, int targetFloor) {
   }
 }
 
+// Parse "z_cm,x_cm" distance to the waiting zone published by the Pi
+void handleApproachUpdate(const char* message) {
+  float z, x;
+  if (sscanf(message, "%f,%f", &z, &x) != 2) {
+    Serial.print("→ Bad approach payload: '");
+    Serial.print(message);
+    Serial.println("'");
+    return;
+  }
+  approachUpdate(approach, z, x, millis(), config.preCall);
+}
+
+unsigned long estimateLiftEtaMs() {
+  unsigned long airtimeMs = radio.getTimeOnAir(sizeof(Message)) / 1000;
+  return liftEtaMs(liftFloor, currentFloor, MAX_FLOOR, airtimeMs,
+                   config.preCall);
+}
+
+// Whether the held floor request should be sent to the panel now
+bool isPreCallDue() {
+  if (!config.preCallEnabled) {
+    return true;
+  }
+  return preCallDue(approach, millis(), estimateLiftEtaMs(), config.preCall);
+}
+
+// LoRa receive interrupt
+#if defined(ESP8266) || defined(ESP32)
+ICACHE_RAM_ATTR
+#endif
+void onPanelFrame() { panelFrameReceived = true; }
+
+// Keep the radio receiving between calls so lift position reports arrive.
+// Power save only duty-cycles between trips; during a trip the lift
+// reports drive the state machine and are received with the radio on.
+void startListeningForPanel() {
+  panelFrameReceived = false;
+  int state;
+  float rxMs;
+  float sleepMs;
+  if (config.powerSave && robotStatus == IDLE && radioProfile >= 0 &&
+      dutyCycleWindows(reportPreamble,
+                       loraSymbolMs(config.profiles[radioProfile].sf,
+                                    config.profiles[radioProfile].bw),
+                       rxMs, sleepMs)) {
+    setRadioPreamble(reportPreamble);
+    state = radio.startReceiveDutyCycle(rxMs * 1000, sleepMs * 1000);
+    accountRadio(rxMs / (rxMs + sleepMs));
+    dutyRxMs = rxMs;
+    dutySleepMs = sleepMs;
+  } else {
+    setRadioPreamble(DEFAULT_PREAMBLE);
+    state = radio.startReceive();
+    accountRadio(1.0);
+    dutyRxMs = 0;
+  }
+  if (state != RADIOLIB_ERR_NONE) {
+    Serial.println("Failed to start LoRa receive, code: " + String(state));
+  }
+}
+
+void pollPanelReports() {
+  if (!panelFrameReceived) {
+    return;
+  }
+  panelFrameReceived = false;
+  if (dutyRxMs > 0) {
+    accountCaughtFrame();
+  }
+  uint8_t messageBuffer[sizeof(Message)];
+  if (radio.getPacketLength() == sizeof(Message) &&
+      radio.readData(messageBuffer, sizeof(Message)) == RADIOLIB_ERR_NONE) {
+    Message *receivedMsg = (Message *)messageBuffer;
+    switch (classifyFrame(*receivedMsg, ROBOT_NODE_ID, PANEL_NODE_ID, bootId,
+                          seqNum)) {
+    case FRAME_DATA:
+      if (receivedMsg->ack == MSG_LIFT_REPORT) {
+        handlePanelReport(*receivedMsg);
+      }
+      break;
+    case FRAME_FOREIGN:
+      foreignFrameCount++;
+      break;
+    case FRAME_ACK:
+    case FRAME_LATE_ACK:
+      // The call that waited for it already finished
+      duplicateFrameCount++;
+      break;
+    default:
+      break;
+    }
+  }
+  startListeningForPanel();
+}
+
+// ACK a lift report, acting on it only the first time it is seen
+void handlePanelReport(const Message &report) {
+  const Message *cached = replayCache.find(report);
+  if (cached != NULL) {
+    duplicateFrameCount++;
+    Serial.println("Duplicate report seq " + String(report.seqNum) +
+                   ", re-sending cached ACK");
+    Message ack = *cached;
+    transmitFrame(ack);
+    return;
+  }
+
+  Message ack = makeAck(report, ROBOT_NODE_ID);
+  ack.timestamp = millis() / 1000;
+
+  // A report older than the newest one seen arrived out of order: ACK it so
+  // the panel stops retrying, but keep the newer lift position. A panel
+  // reboot changes report.boot and starts the order over.
+  if (!panelReportOrder.accept(report)) {
+    staleFrameCount++;
+    Serial.println("Stale report seq " + String(report.seqNum) + ", ignoring");
+  } else {
+    handleLiftReport(report.currentFloor);
+  }
+  replayCache.store(report, ack);
+  transmitFrame(ack);
+}
+
+// Our frame's airtime is the same as the panel's ACK
+unsigned long ackWindowMs() {
+  return radio.getTimeOnAir(sizeof(Message)) / 1000 + config.ackTurnaroundMs;
+}
+
+// Turn a lift position report into a state machine event
+void handleLiftReport(int floor) {
+  liftFloor = floor;
+  Serial.println("Panel reports lift at floor " + String(liftFloor));
+  if (requestedFloor > 0 && floor == requestedFloor) {
+    postEvent(EV_LIFT_AT_TARGET);
+  } else if (currentFloor > 0 && floor == currentFloor) {
+    postEvent(EV_LIFT_AT_PICKUP);
+  } else {
+    postEvent(EV_LIFT_MOVING);
+  }
+}
+
+bool postEvent(RobotEvent event) {
+  if (!eventQueue.push(event)) {
+    Serial.println("Event queue full, dropping " + String(eventNames[event]));
+    return false;
+  }
+  return true;
+}
+
+void processEvents() {
+  RobotEvent event;
+  while (eventQueue.pop(event)) {
+    dispatchEvent(event);
+  }
+}
+
+void dispatchEvent(RobotEvent event) {
+  RobotStatus next;
+  if (findTransition(robotStatus, event, next)) {
+    enterState(next);
+    return;
+  }
+  Serial.println("Ignoring event " + String(eventNames[event]) + " in state " +
+                 String(stateNames[robotStatus]));
+}
+
+void enterState(RobotStatus next) {
+  unsigned long now = millis();
+  recordPhaseDuration(robotStatus, now - stateEnteredAt);
+  Serial.println("State " + String(stateNames[robotStatus]) + " -> " +
+                 String(stateNames[next]) + " after " +
+                 String(now - stateEnteredAt) + " ms");
+  bool idleChanged = (robotStatus == IDLE) != (next == IDLE);
+  robotStatus = next;
+  stateEnteredAt = now;
+  timeoutPosted = false;
+  updateDisplay(statusToString(next), "");
+
+  // Receive mode depends on being between trips. A frame waiting to be
+  // read restarts receive in pollPanelReports() instead.
+  if (config.powerSave && idleChanged && radioProfile >= 0 &&
+      !panelFrameReceived) {
+    startListeningForPanel();
+  }
+
+  // Entry actions
+  switch (next) {
+  case IDLE:
+    currentFloor = 0;
+    requestedFloor = 0;
+    robotAtRwz = false;
+    // A/B test: next trip uses the other profile. Only the trip count
+    // changes, config.activeProfile stays as set.
+    if (config.abTest) {
+      abTrips++;
+    }
+    break;
+  case FLOOR_REQUEST_SUCCESS:
+    floorRequestTime = now;
+    break;
+  case CALLING_ELEVATOR:
+    // Only trips the policy actually timed count, not fallbacks
+    if (config.preCallEnabled &&
+        approachFresh(approach, now, config.preCall)) {
+      preCallCount++;
+      lastHeldBackMs = now - floorRequestTime;
+      totalHeldBackMs += lastHeldBackMs;
+      Serial.println("Pre-call: held " + String(lastHeldBackMs) +
+                     " ms, robot ETA " +
+                     String(robotEtaMs(approach, now, config.preCall)) +
+                     " ms, lift ETA " + String(estimateLiftEtaMs()) + " ms");
+    }
+    // Send floor request to Pi via MQTT (optional - for logging/monitoring)
+    sendFloorRequestToPi(currentFloor, requestedFloor);
+    break;
+  default:
+    break;
+  }
+  pendingPanelMessage = noticeOnEntry(next, pendingPanelMessage);
+}
+
+void checkStateTimeout() {
+  if (!timeoutPosted && stateTimedOut(robotStatus, millis() - stateEnteredAt)) {
+    timeoutPosted = true;
+    postEvent(EV_TIMEOUT);
+  }
+}
+
+void recordPhaseDuration(RobotStatus status, unsigned long durationMs) {
+  int bucket = 0;
+  while (bucket < NUM_PHASE_BUCKETS - 1 &&
+         durationMs >= PHASE_BUCKET_MS[bucket]) {
+    bucket++;
+  }
+  phaseHistogram[status][bucket]++;
+  phaseCount[status]++;
+  phaseTotalMs[status] += durationMs;
+  if (durationMs > phaseMaxMs[status]) {
+    phaseMaxMs[status] = durationMs;
+  }
+}
+
+// Deliver the LoRa message requested by the current state, outside of
+// event dispatch so HTTP and MQTT handlers never block on the radio
+void serviceRadio() {
+  if (pendingPanelMessage == NO_NOTICE) {
+    return;
+  }
+  uint8_t type = pendingPanelMessage;
+  pendingPanelMessage = NO_NOTICE;
+  switch (noticeOutcome(robotStatus, callPanel(type, requestedFloor))) {
+  case NOTICE_ACKED:
+    postEvent(EV_PANEL_ACKED);
+    break;
+  case NOTICE_RETRY:
+    // Robot is riding the lift, keep telling the panel instead of dropping
+    // the trip
+    Serial.println("Panel notice failed, retrying");
+    pendingPanelMessage = type;
+    break;
+  case NOTICE_FAILED:
+    postEvent(EV_PANEL_FAILED);
+    break;
+  }
+  // Blocking transmit/receive took the radio out of receive mode
+  startListeningForPanel();
+}
+
 // Obtain Position Status from Pi via MQTT
 // void getPositionFromPi(String line1, String line2) {
 // }
@@ -252,10 +669,16 @@ String statusToString(RobotStatus status) {
     return "Elevator called";
   case COMMUNICATION_ERROR:
     return "Elevator call failed";
-  case ROBOT_IN:
-    return "Robot is in the elevator";
   case ROBOT_WAIT:
     return "Robot waiting for elevator";
+  case ELEVATOR_ARRIVED:
+    return "Elevator arrived";
+  case ROBOT_IN:
+    return "Robot is in the elevator";
+  case TRAVELLING:
+    return "Elevator travelling";
+  case ELEVATOR_AT_TARGET:
+    return "Elevator at target floor";
   case ROBOT_OUT:
     return "Robot exited elevator";
   default:
@@ -282,9 +705,30 @@ void handleWebRequests() {
     delay(1);
   }
 
+  // Read the body, if any (only /config takes one)
+  String body = "";
+  int lengthPos = request.indexOf("Content-Length: ");
+  if (lengthPos >= 0) {
+    int contentLength = request.substring(lengthPos + 16).toInt();
+    while (contentLength > 0 && body.length() < 512 && client.connected() &&
+           millis() < timeout) {
+      if (client.available()) {
+        body += (char)client.read();
+        contentLength--;
+      } else {
+        delay(1);
+      }
+    }
+  }
+
   // read request
-  if (request.indexOf("GET /status") >= 0) {
+  if (request.indexOf("GET /config") == 0 ||
+      request.indexOf("POST /config") == 0) {
+    handleConfigRequest(client, request, body);
+  } else if (request.indexOf("GET /status") >= 0) {
     handleStatusRequest(client);
+  } else if (request.indexOf("GET /metrics") >= 0) {
+    handleMetricsRequest(client);
   } else if (request.indexOf("GET /") == 0 &&
              request.indexOf("GET /floor/") < 0 &&
              request.indexOf("GET /currentfloor/") < 0) {
@@ -351,7 +795,8 @@ void handleFloorRequest(WiFiClient client, String request) {
   if (floor > 0) {
     requestedFloor = floor;
     updateDisplay("Target floor " + String(requestedFloor), "");
-    robotStatus = FLOOR_REQUEST_SUCCESS;
+    postEvent(EV_FLOOR_REQUEST);
+    processEvents();
     client.println("HTTP/1.1 200 OK");
     client.println("Content-Type: application/json");
     client.println("Connection: close");
@@ -376,7 +821,322 @@ void handleStatusRequest(WiFiClient client) {
   client.println();
   client.println("{\"status\": \"" + statusToString(robotStatus) +
                  "\", \"currentFloor\": " + String(currentFloor) +
-                 ", \"requestedFloor\": " + String(requestedFloor) + "}");
+                 ", \"requestedFloor\": " + String(requestedFloor) +
+                 ", \"liftFloor\": " + String(liftFloor) +
+                 ", \"preCall\": {\"enabled\": " +
+                 String(config.preCallEnabled ? "true" : "false") +
+                 ", \"count\": " + String(preCallCount) +
+                 ", \"lastHeldBackMs\": " + String(lastHeldBackMs) +
+                 ", \"totalHeldBackMs\": " + String(totalHeldBackMs) + "}}");
+}
+
+void handleMetricsRequest(WiFiClient client) {
+  // Send per-state duration histograms as JSON
+  client.println("HTTP/1.1 200 OK");
+  client.println("Content-Type: application/json");
+  client.println("Connection: close");
+  client.println();
+  String json = "{\"bucketsMs\": [";
+  for (int b = 0; b < NUM_PHASE_BUCKETS - 1; b++) {
+    json += (b > 0 ? ", " : "") + String(PHASE_BUCKET_MS[b]);
+  }
+  json += "], \"phases\": {";
+  for (int st = 0; st < NUM_STATUSES; st++) {
+    json += (st > 0 ? ", \"" : "\"") + String(stateNames[st]) +
+            "\": {\"count\": " + String(phaseCount[st]) +
+            ", \"totalMs\": " + String(phaseTotalMs[st]) +
+            ", \"maxMs\": " + String(phaseMaxMs[st]) + ", \"histogram\": [";
+    for (int b = 0; b < NUM_PHASE_BUCKETS; b++) {
+      json += (b > 0 ? ", " : "") + String(phaseHistogram[st][b]);
+    }
+    json += "]}";
+  }
+  json += "}, \"link\": {\"duplicates\": " + String(duplicateFrameCount) +
+          ", \"stale\": " + String(staleFrameCount) +
+          ", \"foreign\": " + String(foreignFrameCount) + "}, \"profiles\": [";
+  for (int p = 0; p < NUM_PROFILES; p++) {
+    ProfileStats &stats = profileStats[p];
+    json += (p > 0 ? ", " : "") + String("{\"calls\": ") +
+            String(stats.calls) + ", \"acked\": " + String(stats.acked) +
+            ", \"failed\": " + String(stats.failed) +
+            ", \"retries\": " + String(stats.retries) +
+            ", \"ackLatencyTotalMs\": " + String(stats.ackLatencyTotalMs) +
+            ", \"ackLatencyMaxMs\": " + String(stats.ackLatencyMaxMs) +
+            ", \"airtimeMs\": " + String(stats.airtimeMs) + "}";
+  }
+  accountRadio(radioOnFraction);
+  json += "], \"energy\": {\"uptimeMs\": " + String(millis()) +
+          ", \"radioOnMs\": " + String((unsigned long)radioOnMs) +
+          ", \"rxDutyPercent\": " + String(radioOnFraction * 100.0) +
+          ", \"cpuActiveMs\": " + String(cpuActiveMs) +
+          ", \"powerSave\": " + String(config.powerSave ? "true" : "false") +
+          "}}";
+  client.println(json);
+}
+
+void handleConfigRequest(WiFiClient client, String request, String body) {
+  if (!isAuthorized(request)) {
+    client.println("HTTP/1.1 401 Unauthorized");
+    client.println("Content-Type: application/json");
+    client.println("Connection: close");
+    client.println();
+    client.println("{\"success\": false, \"error\": \"Unauthorized\"}");
+    return;
+  }
+
+  RobotConfig updated = config;
+  bool valid = true;
+  if (request.indexOf("POST /config/profile/") == 0) {
+    int idPos = String("POST /config/profile/").length();
+    String id = request.substring(idPos, request.indexOf(" ", idPos));
+    int profile = (id.length() == 1 && isDigit(id[0])) ? id.toInt() : -1;
+    if (profile < 0 || profile >= NUM_PROFILES) {
+      valid = false;
+    } else {
+      valid = updateProfile(updated.profiles[profile], body.c_str());
+    }
+    // MSG_PROFILE_SWITCH only carries the profile index, so the panel can't
+    // follow a retune of the link in use. Switch away from it first.
+    if (valid && profile == radioProfile &&
+        !sameLink(updated.profiles[profile], config.profiles[profile])) {
+      client.println("HTTP/1.1 409 Conflict");
+      client.println("Content-Type: application/json");
+      client.println("Connection: close");
+      client.println();
+      client.println("{\"success\": false, \"error\": \"Profile in use, "
+                     "switch to another profile first\"}");
+      return;
+    }
+  } else if (request.indexOf("POST /config") == 0) {
+    valid = updateConfig(updated, body.c_str());
+    float value;
+    if (valid && jsonNumber(body.c_str(), "resetStats", value) == JSON_OK &&
+        value != 0) {
+      memset(profileStats, 0, sizeof(profileStats));
+    }
+  } else if (request.indexOf("GET /config") != 0) {
+    valid = false;
+  }
+  valid &= powerSaveFits(updated);
+
+  if (!valid) {
+    client.println("HTTP/1.1 400 Bad Request");
+    client.println("Content-Type: application/json");
+    client.println("Connection: close");
+    client.println();
+    client.println("{\"success\": false, \"error\": \"Invalid config\"}");
+    return;
+  }
+
+  if (request.indexOf("POST ") == 0) {
+    mqttServerChanged = strcmp(updated.mqttBroker, config.mqttBroker) != 0;
+    bool powerChanged = updated.powerSave != config.powerSave;
+    // Only TX power and the report preamble can change on the profile in
+    // use; other profiles are programmed when switched to
+    if (radioProfile >= 0 &&
+        (updated.profiles[radioProfile].power !=
+             config.profiles[radioProfile].power ||
+         powerChanged ||
+         updated.maxWakeLatencyMs != config.maxWakeLatencyMs)) {
+      radioConfigChanged = true;
+    }
+    config = updated;
+    if (powerChanged) {
+      applyPowerMode();
+    }
+    if (!saveConfig()) {
+      Serial.println("Failed to save config to NVS");
+    }
+    Serial.println("Config updated: " + configToJson());
+  }
+  client.println("HTTP/1.1 200 OK");
+  client.println("Content-Type: application/json");
+  client.println("Connection: close");
+  client.println();
+  client.println(configToJson());
+}
+
+void loadConfig() {
+  configStore.begin();
+  if (loadStoredConfig(configStore, config)) {
+    Serial.println("Loaded config from NVS");
+  } else {
+    Serial.println("Using default config");
+  }
+  // First boot: no shared default token, this device gets its own
+  if (provisionToken(config, esp_random)) {
+    tokenGenerated = true;
+    Serial.println("New config token: " + String(config.token));
+    if (!saveConfig()) {
+      Serial.println("Failed to save config to NVS");
+    }
+  }
+}
+
+bool saveConfig() {
+  return configStore.write(config);
+}
+
+// Program a radio profile, only called while no LoRa exchange is running
+void applyRadioProfile(int profile) {
+  RadioProfile &radioCfg = config.profiles[profile];
+  reportPreamble = DEFAULT_PREAMBLE;
+  if (config.powerSave) {
+    // /config rejects longer ones, a config stored before that is clamped
+    long symbols =
+        wakePreambleSymbols(radioCfg.sf, radioCfg.bw, config.maxWakeLatencyMs);
+    reportPreamble =
+        symbols < MAX_PREAMBLE_SYMBOLS ? symbols : MAX_PREAMBLE_SYMBOLS;
+  }
+  radio.standby();
+  setRadioPreamble(DEFAULT_PREAMBLE);
+  radio.setFrequency(radioCfg.freq);
+  radio.setSpreadingFactor(radioCfg.sf);
+  radio.setBandwidth(radioCfg.bw);
+  radio.setCodingRate(radioCfg.cr);
+  radio.setOutputPower(radioCfg.power);
+  radioProfile = profile;
+  Serial.println("Radio profile " + String(profile) + ": " +
+                 String(radioCfg.freq) + " MHz SF" + String(radioCfg.sf) +
+                 " BW" + String(radioCfg.bw) + " CR4/" + String(radioCfg.cr) +
+                 " " + String(radioCfg.power) + " dBm, report preamble " +
+                 String(reportPreamble));
+  startListeningForPanel();
+}
+
+// Both ends have to retune together, so the switch is announced on the
+// current profile first. If only our ACK got lost the panel is already on
+// the new profile, so ask once more there before going back.
+bool switchRadioProfile(int profile) {
+  int previous = radioProfile;
+  Serial.println("Announcing radio profile " + String(profile));
+  if (callPanel(MSG_PROFILE_SWITCH, profile)) {
+    applyRadioProfile(profile);
+    return true;
+  }
+  applyRadioProfile(profile);
+  if (callPanel(MSG_PROFILE_SWITCH, profile)) {
+    return true;
+  }
+  Serial.println("Panel did not confirm profile " + String(profile) +
+                 ", staying on " + String(previous));
+  applyRadioProfile(previous);
+  return false;
+}
+
+// Preamble length is a packet parameter, only change it in standby
+void setRadioPreamble(uint16_t length) {
+  if (length == radioPreamble) {
+    return;
+  }
+  radio.standby();
+  radio.setPreambleLength(length);
+  radioPreamble = length;
+}
+
+// Radio-on time, integrated over the receive mode in use
+void accountRadio(float nextFraction) {
+  unsigned long now = millis();
+  radioOnMs += (now - radioAccountedAt) * radioOnFraction;
+  radioAccountedAt = now;
+  radioOnFraction = nextFraction;
+}
+
+// The window that caught a frame in duty-cycle receive kept the receiver
+// on to the end of the frame, not just for its share of that stretch
+void accountCaughtFrame() {
+  RadioProfile &radioCfg = config.profiles[radioProfile];
+  float airtimeMs = loraAirtimeMs(radioCfg.sf, radioCfg.bw, radioCfg.cr,
+                                  reportPreamble, sizeof(Message));
+  accountRadio(radioOnFraction);
+  radioOnMs += caughtFrameOnMs(airtimeMs, dutyRxMs, dutySleepMs) *
+               (1.0 - radioOnFraction);
+}
+
+// Loop wait. Returns as soon as a panel frame or an HTTP client is
+// waiting, so the long power save wait delays neither by more than
+// WAKE_POLL_MS.
+void waitForWork(unsigned long maxMs) {
+  unsigned long start = millis();
+  while (millis() - start < maxMs && !panelFrameReceived &&
+         !server.hasClient()) {
+    delay(WAKE_POLL_MS);
+  }
+}
+
+// The AP has to keep beaconing, so instead of light sleep the power mode
+// lowers WiFi TX power and CPU clock and lengthens the idle loop delay
+void applyPowerMode() {
+  if (config.powerSave) {
+    WiFi.setTxPower(WIFI_POWER_8_5dBm);
+    setCpuFrequencyMhz(80);
+  } else {
+    WiFi.setTxPower(WIFI_POWER_19_5dBm);
+    setCpuFrequencyMhz(240);
+  }
+  Serial.println("Power save " + String(config.powerSave ? "on" : "off"));
+}
+
+// Transmit a frame, counting its airtime against the active profile
+int transmitFrame(Message &msg) {
+  // Short preamble: the panel receives with its radio fully on
+  setRadioPreamble(DEFAULT_PREAMBLE);
+  if (radioProfile >= 0) {
+    profileStats[radioProfile].airtimeMs +=
+        radio.getTimeOnAir(sizeof(Message)) / 1000;
+  }
+  accountRadio(1.0);
+  return radio.transmit((uint8_t *)&msg, sizeof(Message));
+}
+
+bool isAuthorized(String request) {
+  String header = "Authorization: Bearer ";
+  int startPos = request.indexOf(header);
+  if (startPos < 0) {
+    return false;
+  }
+  startPos += header.length();
+  int endPos = request.indexOf("\r", startPos);
+  if (endPos < 0) {
+    endPos = request.length();
+  }
+  return tokenMatches(config, request.substring(startPos, endPos).c_str());
+}
+
+String configToJson() {
+  String json = "{\"broker\": \"" + String(config.mqttBroker) +
+                "\", \"activeProfile\": " + String(config.activeProfile) +
+                ", \"radioProfile\": " + String(radioProfile) +
+                ", \"tripProfile\": " + String(tripProfile(config, abTrips)) +
+                ", \"abTest\": " + String(config.abTest ? "true" : "false") +
+                ", \"maxRetries\": " + String(config.maxRetries) +
+                ", \"mqttRetryIntervalMs\": " +
+                String(config.mqttRetryIntervalMs) +
+                ", \"ackTurnaroundMs\": " + String(config.ackTurnaroundMs) +
+                ", \"retryBackoffMaxMs\": " +
+                String(config.retryBackoffMaxMs) +
+                ", \"powerSave\": " + String(config.powerSave ? "true" : "false") +
+                ", \"maxWakeLatencyMs\": " + String(config.maxWakeLatencyMs) +
+                ", \"reportPreamble\": " + String(reportPreamble) +
+                ", \"preCallEnabled\": " +
+                String(config.preCallEnabled ? "true" : "false") +
+                ", \"approachSpeedCmPerSec\": " +
+                String(config.preCall.approachSpeedCmPerSec) +
+                ", \"liftTravelPerFloorMs\": " +
+                String(config.preCall.liftTravelPerFloorMs) +
+                ", \"liftDoorOpenMs\": " + String(config.preCall.liftDoorOpenMs) +
+                ", \"preCallMarginMs\": " + String(config.preCall.marginMs) +
+                ", \"approachStaleMs\": " + String(config.preCall.staleMs) +
+                ", \"profiles\": [";
+  for (int p = 0; p < NUM_PROFILES; p++) {
+    RadioProfile &radioCfg = config.profiles[p];
+    json += (p > 0 ? ", " : "") + String("{\"freq\": ") +
+            String(radioCfg.freq) + ", \"sf\": " + String(radioCfg.sf) +
+            ", \"bw\": " + String(radioCfg.bw) +
+            ", \"cr\": " + String(radioCfg.cr) +
+            ", \"power\": " + String(radioCfg.power) + "}";
+  }
+  return json + "]}";
 }
 
 void sendWebPage(WiFiClient client) {
@@ -522,49 +1282,76 @@ void sendWebPage(WiFiClient client) {
   client.println("</html>");
 }
 
+// Wait for the ACK to the current seqNum. Unrelated frames are handled or
+// skipped and listening continues until the window ends.
 bool listenForAck(unsigned long timeoutMs) {
   Serial.println("------Listening for ACK----");
   updateDisplay("Waiting for ACK from panel", "");
+  accountRadio(1.0);
   unsigned long startTime = millis();
   while (millis() - startTime < timeoutMs) {
     uint8_t messageBuffer[sizeof(Message)];
     int state = radio.receive(messageBuffer, sizeof(Message));
-    if (state == RADIOLIB_ERR_NONE) {
-      // cast back to message struct
-      Message *receivedMsg = (Message *)messageBuffer;
-      // If msg is ACK,
-      if (receivedMsg->ack == 1 && receivedMsg->seqNum == seqNum) {
-        Serial.println("ACK received from panel!");
-        updateDisplay("Received ACK from panel", "");
-        return true;
-      } else if (receivedMsg->ack == 0) {
-        Serial.println("Ignoring request message from myself");
+    if (state != RADIOLIB_ERR_NONE) {
+      continue;
+    }
+    // cast back to message struct
+    Message *receivedMsg = (Message *)messageBuffer;
+    switch (classifyFrame(*receivedMsg, ROBOT_NODE_ID, PANEL_NODE_ID, bootId,
+                          seqNum)) {
+    case FRAME_OWN:
+      Serial.println("Ignoring request message from myself");
+      break;
+    case FRAME_FOREIGN:
+      foreignFrameCount++;
+      Serial.println("Ignoring frame for node " + String(receivedMsg->dst) +
+                     " from node " + String(receivedMsg->src));
+      break;
+    case FRAME_ACK:
+      Serial.println("ACK received from panel!");
+      updateDisplay("Received ACK from panel", "");
+      return true;
+    case FRAME_LATE_ACK:
+      // Late ACK for an earlier message, already confirmed
+      duplicateFrameCount++;
+      Serial.println("Ignoring ACK for old seq " +
+                     String(receivedMsg->seqNum));
+      break;
+    case FRAME_DATA:
+      if (receivedMsg->ack == MSG_LIFT_REPORT) {
+        handlePanelReport(*receivedMsg);
       } else {
-        // Keep listening, if there's no ACK
-        return false;
+        Serial.println("Ignoring unexpected message type " +
+                       String(receivedMsg->ack));
       }
+      break;
     }
   }
   Serial.println("Listen timeout - no valid ACK received");
   return false;
 }
 
-void sendElevatorRequest() {
+bool sendElevatorRequest(uint8_t type, uint8_t target) {
   Serial.println("Sending LoRa message...");
   // Create binary message
   Message msg;
-  msg.ack = 0; // 0 = request, 1 = acknowledgment
+  msg.ack = type;
+  msg.src = ROBOT_NODE_ID;
+  msg.dst = PANEL_NODE_ID;
+  msg.boot = bootId;
   msg.seqNum = seqNum;
   msg.currentFloor = currentFloor;
-  msg.targetFloor = requestedFloor;
+  msg.targetFloor = target;
   msg.timestamp = millis() / 1000;
   Serial.println("Message details");
-  Serial.println("   Sequence: " + String(msg.seqNum));
+  Serial.println("   Type: " + String(msg.ack));
+  Serial.println("   Boot: " + String(msg.boot) +
+                 " Sequence: " + String(msg.seqNum));
   Serial.println("   Current Floor: " + String(msg.currentFloor));
   Serial.println("   Target Floor: " + String(msg.targetFloor));
   Serial.println("Bytes sent: " + String(sizeof(msg)));
   // Send
-  int state = radio.transmit((uint8_t *)&msg, sizeof(msg));
+  int state = transmitFrame(msg);
   if (state == RADIOLIB_ERR_NONE) {
     // Print message details for debugging
     Serial.println("Request succuesfully sent!");
@@ -572,33 +1359,81 @@ void sendElevatorRequest() {
                   "target floor: " + String(msg.targetFloor));
   } else {
     Serial.println("Binary transmission failed, code: " + String(state));
-    robotStatus = COMMUNICATION_ERROR;
-    return; // Exit early on failure
+    return false;
+  }
+  return true;
+}
+
+// Send a message to the panel, retrying until it is ACKed
+bool callPanel(uint8_t type, uint8_t target) {
+  // radio.begin() failed in setup(), no profile to count against
+  if (radioProfile < 0) {
+    Serial.println("LoRa not initialized, cannot send message type " +
+                   String(type));
+    return false;
+  }
+  // Increment sequence number
+  seqNum++;
+  ProfileStats &stats = profileStats[radioProfile];
+  stats.calls++;
+  // Variable to keep track of retries
+  int numRetries = 0;
+  unsigned long startTime = millis();
+  while (numRetries <= config.maxRetries) {
+    if (sendElevatorRequest(type, target) && listenForAck(ackWindowMs())) {
+      unsigned long latency = millis() - startTime;
+      stats.acked++;
+      stats.ackLatencyTotalMs += latency;
+      if (latency > stats.ackLatencyMaxMs) {
+        stats.ackLatencyMaxMs = latency;
+      }
+      Serial.println("Panel confirmed message type " + String(type) +
+                     " after " + String(latency) + " ms");
+      return true;
+    }
+    numRetries++;
+    stats.retries++;
+    updateDisplay("Didn't receive ACK back", "Send request again");
+    Serial.println(
+        "Didn't receive ACK back. Send request again. Retry attempt " +
+        String(numRetries) + " Seq: " + String(seqNum));
+    // Same seqNum on retry, the panel won't act on it twice
+    delay(random(config.retryBackoffMaxMs));
   }
+  stats.failed++;
+  Serial.println("Failed to receive ack after " + String(config.maxRetries) +
+                 " retries");
+  return false;
 }
 
-bool robotIn(int inputPin) {
+// Pi's GPIO output: HIGH while an AprilTag is within 4 m of the camera,
+// which already happens on the approach. pinEvent() decides what an edge
+// means; entering and exiting come from MQTT.
+void pollRobotPin(int inputPin) {
   int currentState = digitalRead(inputPin);
   if (currentState != lastState) {
     lastState = currentState;
-    if (currentState == HIGH) {
-      Serial.println("Elevator Entered");
-      return true;
-    } else {
-      Serial.println(" Elevator Exited");
-      return false;
+    Serial.println(currentState == HIGH ? "Tag in range" : "Tag out of range");
+    RobotEvent event;
+    if (pinEvent(currentState == HIGH, robotAtRwz, event)) {
+      postEvent(event);
     }
   }
-  delay(50);
-  return false;
 }
 
 void setup() {
   Serial.begin(115200);
   pinMode(inputPin, INPUT_PULLDOWN);
   delay(300);
+  // seqNum restarts at 0, a new boot id keeps the panel's replay cache from
+  // answering our first frames with ACKs from before the reboot
+  bootId = esp_random();
+  Serial.println("Boot id: " + String(bootId));
+  loadConfig();
   // WiFi hotspot setup
   WiFi.softAP(ssid, password);
+  // TX power can only be set once the AP is up
+  applyPowerMode();
   server.begin();
   Serial.println("WiFi hotspot started");
   Serial.println("Connect to: " + String(ssid));
@@ -608,12 +1443,12 @@ void setup() {
   digitalWrite(LORA_VEXT, LOW);
   delay(500);
   Serial.print("Initializing LoRa... ");
-  if (radio.begin(LORA_FREQ) == RADIOLIB_ERR_NONE) {
+  if (radio.begin(config.profiles[config.activeProfile].freq) ==
+      RADIOLIB_ERR_NONE) {
     Serial.println("SUCCESS!");
-    radio.setSpreadingFactor(12);
-    radio.setBandwidth(125.0);
-    radio.setCodingRate(5);
-    radio.setOutputPower(14);
+    applyRadioProfile(config.activeProfile);
+    radio.setDio1Action(onPanelFrame);
+    startListeningForPanel();
   } else {
     Serial.println("Failed");
   }
@@ -631,9 +1466,12 @@ void setup() {
   display.init();
   display.flipScreenVertically();
   display.setFont(ArialMT_Plain_10);
+  if (tokenGenerated) {
+    updateDisplay("New config token:", String(config.token));
+  }
 
   // MQTT initialization
-  mqttClient.setServer(mqttBroker, mqttPort);
+  mqttClient.setServer(config.mqttBroker, mqttPort);
   mqttClient.setCallback(mqttCallback);
   mqttClient.setKeepAlive(60);  // 60 second keepalive
   mqttClient.setSocketTimeout(5);  // 5 second socket timeout
@@ -642,13 +1480,34 @@ void setup() {
 }
 
 void loop() {
+  unsigned long loopStart = micros();
+
   // Handle incoming web requests (MUST be called regularly - non-blocking)
   handleWebRequests();
   
+  // Apply config changes; the radio is only retuned between trips
+  if (mqttServerChanged) {
+    mqttServerChanged = false;
+    mqttClient.disconnect();  // reconnects to the new broker below
+  }
+  int nextProfile = tripProfile(config, abTrips);
+  if (robotStatus == IDLE && radioProfile >= 0 &&
+      nextProfile != radioProfile && millis() >= nextProfileSwitchAt) {
+    if (switchRadioProfile(nextProfile)) {
+      radioConfigChanged = false;
+    } else {
+      nextProfileSwitchAt = millis() + PROFILE_SWITCH_RETRY_MS;
+    }
+  }
+  if (robotStatus == IDLE && radioConfigChanged) {
+    radioConfigChanged = false;
+    applyRadioProfile(radioProfile);
+  }
+
   // Maintain MQTT connection (non-blocking attempt, rate-limited)
   if (!mqttClient.connected()) {
     unsigned long now = millis();
-    if (now - lastMQTTAttempt >= MQTT_RETRY_INTERVAL) {
+    if (now - lastMQTTAttempt >= config.mqttRetryIntervalMs) {
       connectMQTT();  // Attempts once, returns immediately
       lastMQTTAttempt = now;
     }
@@ -657,6 +1516,12 @@ void loop() {
   // Process MQTT messages (non-blocking) - MUST be called frequently
   if (mqttClient.connected()) {
     mqttClient.loop();  // Must call regularly to process incoming messages
+    // loop() handles one packet per call; drain what queued up during the
+    // loop delay so approach telemetry doesn't fall behind
+    for (int i = 1; i < MQTT_MAX_PACKETS_PER_LOOP && wifiClient.available() > 0;
+         i++) {
+      mqttClient.loop();
+    }
     
     // Only show status if we haven't received a message recently
     if (millis() - lastMQTTMessageTime > MQTT_MESSAGE_DISPLAY_DURATION) {
@@ -694,7 +1559,8 @@ void loop() {
   if (mqttClient.connected() && (millis() - lastSubscriptionCheck > 30000)) {
     // Resubscribe every 30 seconds to ensure subscription is active
     Serial.println("Re-subscribing to ensure subscription is active...");
-    if (mqttClient.subscribe(topicRobotIn, 1)) {
+    if (mqttClient.subscribe(topicRobotIn, 1) &&
+        mqttClient.subscribe(topicApproach, 0)) {
       Serial.println("Re-subscription successful");
     } else {
       Serial.println("Re-subscription failed!");
@@ -702,58 +1568,27 @@ void loop() {
     lastSubscriptionCheck = millis();
   }
   
-  // Check if robot should send LoRa message
-  if (robotStatus == FLOOR_REQUEST_SUCCESS && requestedFloor > 0) {
-    robotStatus = CALLING_ELEVATOR;
-    
-    // Send floor request to Pi via MQTT (optional - for logging/monitoring)
-    sendFloorRequestToPi(currentFloor, requestedFloor);
-    // getPositionFromPi("Getting position", "");
-
-    mqttClient.loop();
-    
-    // Increment sequence number
-    seqNum++;
-    bool received_ack = false;
-    // Variable to keep track of retries
-    int numRetries = 0;
-    while (!received_ack && (numRetries <= maxRetries)) {
-      sendElevatorRequest();
-      received_ack = listenForAck(1000);
-      if (received_ack) {
-        robotStatus = ELEVATOR_CONFIRMED;
-        Serial.println("Elevator request confirmed!");
-        // reset back to accept new request for now, TODO: add more state
-        // management
-        // check if the robot is in the elevator
-        // while (!robotIn(inputPin)) {
-        //   delay(300);
-        // }
-        // robotStatus = ROBOT_IN;
-        // Serial.println("Robot is in the elevator");
-        // delay(500);
-        robotStatus = IDLE;
-        currentFloor = 0;
-        requestedFloor = 0;
-        break;
-      } else {
-        numRetries++;
-        updateDisplay("Didn't receive ACK back", "Send request again");
-        Serial.println(
-            "Didn't receive ACK back. Send request again. Retry attempt " +
-            String(numRetries) + " Seq: " + String(seqNum));
-        delay(2000);
-      }
-    }
-    if (!received_ack) {
-      Serial.println("Failed to receive ack after" + String(maxRetries) +
-                     ".Please request floor again");
-      robotStatus = COMMUNICATION_ERROR;
-      // Reset for testing
-      robotStatus = IDLE;
-      currentFloor = 0;
-      requestedFloor = 0;
-    }
+  // Collect events from LoRa, GPIO and timers, then run the state machine
+  pollPanelReports();
+  pollRobotPin(inputPin);
+  if (robotStatus == FLOOR_REQUEST_SUCCESS && isPreCallDue()) {
+    postEvent(EV_CALL_DUE);
   }
-  delay(1000);
+  checkStateTimeout();
+  processEvents();
+
+  // Radio exchanges requested by the new state, results come back as events
+  serviceRadio();
+  processEvents();
+
+  cpuActiveUs += micros() - loopStart;
+  cpuActiveMs += cpuActiveUs / 1000;
+  cpuActiveUs %= 1000;
+
+  // The long power save wait is only used between trips, during a trip
+  // telemetry and events need the short one. A panel frame or HTTP client
+  // ends the wait early; a LoRa exchange in the loop body (a call or a
+  // profile switch) still blocks for its ACK windows and retries.
+  waitForWork(config.powerSave && robotStatus == IDLE ? config.maxWakeLatencyMs
+                                                      : 100);
 }
@@ -0,0 +1,374 @@
+#ifndef ROBOT_CONFIG_H
+#define ROBOT_CONFIG_H
+
+// Runtime configuration: the typed config, its storage, the access token
+// and the /config JSON parsing and validation. No Arduino dependencies, so
+// test/test_config.cpp can run it on the host with an in-memory store.
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "power_model.h"
+#include "precall_policy.h"
+
+// Radio settings, two profiles so operators can A/B them
+struct RadioProfile {
+  float freq;     // MHz
+  uint8_t sf;     // spreading factor
+  float bw;       // kHz
+  uint8_t cr;     // coding rate 4/x
+  int8_t power;   // dBm
+};
+#define NUM_PROFILES 2
+
+// Runtime configuration, persisted in NVS and editable over /config
+#define CONFIG_VERSION 4
+struct RobotConfig {
+  uint8_t version;
+  char token[24];                   // bearer token for /config, "" = none
+  char mqttBroker[16];              // Pi's IP when connected to ESP32's network
+  RadioProfile profiles[NUM_PROFILES];
+  uint8_t activeProfile;
+  bool abTest;                      // alternate profiles on every trip
+  int maxRetries;
+  unsigned long mqttRetryIntervalMs;
+  unsigned long ackTurnaroundMs;    // panel processing time
+  unsigned long retryBackoffMaxMs;  // random jitter before retry
+  bool powerSave;                   // duty-cycled LoRa RX, low-power WiFi/CPU
+  unsigned long maxWakeLatencyMs;   // power save bound on lift report latency
+  bool preCallEnabled;              // hold the call until the robot is close
+  PreCallTuning preCall;
+};
+
+// No token: every device generates its own on first boot
+const RobotConfig DEFAULT_CONFIG = {
+    CONFIG_VERSION,
+    "",
+    "192.168.4.10",
+    {{920.0, 12, 125.0, 5, 14}, {920.0, 9, 125.0, 5, 14}},
+    0,
+    false,
+    5,
+    5000,
+    200,
+    500,
+    false,
+    1000,
+    true,
+    DEFAULT_PRECALL_TUNING,
+};
+
+// Where the config blob lives: NVS on the robot, memory in the tests
+class ConfigStore {
+public:
+  virtual ~ConfigStore() {}
+  // false if nothing of the right size is stored
+  virtual bool read(RobotConfig &config) = 0;
+  virtual bool write(const RobotConfig &config) = 0;
+};
+
+// Fill in a random token if none is provisioned yet. Returns true if one
+// was generated and has to be saved and shown to the operator.
+inline bool provisionToken(RobotConfig &config, uint32_t (*random32)()) {
+  if (config.token[0] != '\0') {
+    return false;
+  }
+  snprintf(config.token, sizeof(config.token), "%08lx%08lx",
+           (unsigned long)random32(), (unsigned long)random32());
+  return true;
+}
+
+// An empty token never matches, so POST is refused until one is set
+inline bool tokenMatches(const RobotConfig &config, const char *presented) {
+  size_t length = strlen(config.token);
+  if (length == 0 || strlen(presented) != length) {
+    return false;
+  }
+  unsigned char diff = 0;
+  for (size_t i = 0; i < length; i++) {
+    diff |= config.token[i] ^ presented[i];
+  }
+  return diff == 0;
+}
+
+// Profile used for the next trip. The A/B alternation is runtime only,
+// config.activeProfile stays what the operator set.
+inline int tripProfile(const RobotConfig &config, unsigned long abTrips) {
+  if (!config.abTest) {
+    return config.activeProfile;
+  }
+  return (config.activeProfile + abTrips) % NUM_PROFILES;
+}
+
+// Minimal flat JSON readers, enough for the /config bodies
+enum JsonField { JSON_ABSENT, JSON_OK, JSON_INVALID };
+
+// Find "key": and point value at what follows
+inline JsonField jsonValue(const char *body, const char *key,
+                           const char *&value) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+  const char *pos = strstr(body, pattern);
+  if (pos == NULL) {
+    return JSON_ABSENT;
+  }
+  pos += strlen(pattern);
+  while (isspace((unsigned char)*pos)) {
+    pos++;
+  }
+  if (*pos != ':') {
+    return JSON_INVALID;
+  }
+  pos++;
+  while (isspace((unsigned char)*pos)) {
+    pos++;
+  }
+  value = pos;
+  return JSON_OK;
+}
+
+// A value has to end at the next member or the end of the object
+inline bool jsonValueEnds(const char *end) {
+  while (isspace((unsigned char)*end)) {
+    end++;
+  }
+  return *end == ',' || *end == '}' || *end == '\0';
+}
+
+// Numbers and true/false, anything else present under the key is invalid
+inline JsonField jsonNumber(const char *body, const char *key, float &value) {
+  const char *start;
+  JsonField found = jsonValue(body, key, start);
+  if (found != JSON_OK) {
+    return found;
+  }
+  if (strncmp(start, "true", 4) == 0 && jsonValueEnds(start + 4)) {
+    value = 1;
+    return JSON_OK;
+  }
+  if (strncmp(start, "false", 5) == 0 && jsonValueEnds(start + 5)) {
+    value = 0;
+    return JSON_OK;
+  }
+  char *end;
+  double parsed = strtod(start, &end);
+  if (end == start || !jsonValueEnds(end) || !isfinite(parsed)) {
+    return JSON_INVALID;
+  }
+  value = parsed;
+  return JSON_OK;
+}
+
+inline JsonField jsonString(const char *body, const char *key, char *value,
+                            size_t size) {
+  const char *start;
+  JsonField found = jsonValue(body, key, start);
+  if (found != JSON_OK) {
+    return found;
+  }
+  const char *end = *start == '"' ? strchr(start + 1, '"') : NULL;
+  if (end == NULL || !jsonValueEnds(end + 1)) {
+    return JSON_INVALID;
+  }
+  size_t length = end - start - 1;
+  if (length == 0 || length >= size) {
+    return JSON_INVALID;
+  }
+  memcpy(value, start + 1, length);
+  value[length] = '\0';
+  return JSON_OK;
+}
+
+// Accepted value ranges, shared by /config and the check of a stored blob
+struct Range {
+  float lo;
+  float hi;
+};
+const Range BOOL_RANGE = {0, 1};
+const Range ACTIVE_PROFILE_RANGE = {0, NUM_PROFILES - 1};
+const Range MAX_RETRIES_RANGE = {0, 20};
+const Range MQTT_RETRY_INTERVAL_RANGE = {100, 3600000};
+const Range ACK_TURNAROUND_RANGE = {0, 10000};
+const Range RETRY_BACKOFF_RANGE = {1, 10000};
+const Range WAKE_LATENCY_RANGE = {100, 10000};
+const Range APPROACH_SPEED_RANGE = {1, 200};
+const Range LIFT_TRAVEL_RANGE = {500, 60000};
+const Range LIFT_DOOR_OPEN_RANGE = {0, 60000};
+const Range PRECALL_MARGIN_RANGE = {0, 60000};
+const Range APPROACH_STALE_RANGE = {500, 60000};
+const Range FREQ_RANGE = {150.0, 960.0};
+const Range SF_RANGE = {5, 12};
+const Range BW_RANGE = {7.8, 500.0};
+const Range CR_RANGE = {5, 8};
+const Range POWER_RANGE = {-9, 22};
+const size_t BROKER_MIN_LENGTH = 7;
+const size_t TOKEN_MIN_LENGTH = 8;
+
+inline bool inRange(float value, const Range &range) {
+  return value >= range.lo && value <= range.hi;
+}
+
+// Set field from body[key] if present. The range is checked before the
+// conversion, and integer fields take whole numbers only. false if the key
+// is present but not acceptable.
+template <typename T>
+inline bool readField(const char *body, const char *key, const Range &range,
+                      T &field) {
+  float value;
+  JsonField found = jsonNumber(body, key, value);
+  if (found == JSON_ABSENT) {
+    return true;
+  }
+  if (found == JSON_INVALID || !inRange(value, range) ||
+      (float)(T)value != value) {
+    return false;
+  }
+  field = (T)value;
+  return true;
+}
+
+inline bool readString(const char *body, const char *key, size_t minLength,
+                       char *field, size_t size) {
+  char value[64];
+  JsonField found = jsonString(body, key, value, size < sizeof(value)
+                                                     ? size
+                                                     : sizeof(value));
+  if (found == JSON_ABSENT) {
+    return true;
+  }
+  if (found == JSON_INVALID || strlen(value) < minLength) {
+    return false;
+  }
+  strcpy(field, value);
+  return true;
+}
+
+// POST /config body. Applies to a copy, the caller keeps it only if valid.
+inline bool updateConfig(RobotConfig &config, const char *body) {
+  bool valid = true;
+  valid &= readString(body, "broker", BROKER_MIN_LENGTH, config.mqttBroker,
+                      sizeof(config.mqttBroker));
+  valid &= readString(body, "token", TOKEN_MIN_LENGTH, config.token,
+                      sizeof(config.token));
+  valid &= readField(body, "activeProfile", ACTIVE_PROFILE_RANGE,
+                     config.activeProfile);
+  valid &= readField(body, "abTest", BOOL_RANGE, config.abTest);
+  valid &= readField(body, "maxRetries", MAX_RETRIES_RANGE, config.maxRetries);
+  valid &= readField(body, "mqttRetryIntervalMs", MQTT_RETRY_INTERVAL_RANGE,
+                     config.mqttRetryIntervalMs);
+  valid &= readField(body, "ackTurnaroundMs", ACK_TURNAROUND_RANGE,
+                     config.ackTurnaroundMs);
+  valid &= readField(body, "retryBackoffMaxMs", RETRY_BACKOFF_RANGE,
+                     config.retryBackoffMaxMs);
+  valid &= readField(body, "powerSave", BOOL_RANGE, config.powerSave);
+  valid &= readField(body, "maxWakeLatencyMs", WAKE_LATENCY_RANGE,
+                     config.maxWakeLatencyMs);
+  valid &= readField(body, "preCallEnabled", BOOL_RANGE, config.preCallEnabled);
+  valid &= readField(body, "approachSpeedCmPerSec", APPROACH_SPEED_RANGE,
+                     config.preCall.approachSpeedCmPerSec);
+  valid &= readField(body, "liftTravelPerFloorMs", LIFT_TRAVEL_RANGE,
+                     config.preCall.liftTravelPerFloorMs);
+  valid &= readField(body, "liftDoorOpenMs", LIFT_DOOR_OPEN_RANGE,
+                     config.preCall.liftDoorOpenMs);
+  valid &= readField(body, "preCallMarginMs", PRECALL_MARGIN_RANGE,
+                     config.preCall.marginMs);
+  valid &= readField(body, "approachStaleMs", APPROACH_STALE_RANGE,
+                     config.preCall.staleMs);
+  return valid;
+}
+
+// In power save every profile's report preamble has to fit the radio's
+// 16-bit preamble length, which rules out long wake latencies on very fast
+// profiles (SF5 at 500 kHz is 0.064 ms per symbol)
+inline bool powerSaveFits(const RobotConfig &config) {
+  if (!config.powerSave) {
+    return true;
+  }
+  for (int p = 0; p < NUM_PROFILES; p++) {
+    const RadioProfile &profile = config.profiles[p];
+    if (wakePreambleSymbols(profile.sf, profile.bw, config.maxWakeLatencyMs) >
+        MAX_PREAMBLE_SYMBOLS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// POST /config/profile/<n> body
+inline bool updateProfile(RadioProfile &profile, const char *body) {
+  bool valid = true;
+  valid &= readField(body, "freq", FREQ_RANGE, profile.freq);
+  valid &= readField(body, "sf", SF_RANGE, profile.sf);
+  valid &= readField(body, "bw", BW_RANGE, profile.bw);
+  valid &= readField(body, "cr", CR_RANGE, profile.cr);
+  valid &= readField(body, "power", POWER_RANGE, profile.power);
+  return valid;
+}
+
+// Whether two profiles put the radio on the same link. Both ends have to
+// agree on these; TX power is ours alone.
+inline bool sameLink(const RadioProfile &a, const RadioProfile &b) {
+  return a.freq == b.freq && a.sf == b.sf && a.bw == b.bw && a.cr == b.cr;
+}
+
+inline bool profileValid(const RadioProfile &profile) {
+  return inRange(profile.freq, FREQ_RANGE) && inRange(profile.sf, SF_RANGE) &&
+         inRange(profile.bw, BW_RANGE) && inRange(profile.cr, CR_RANGE) &&
+         inRange(profile.power, POWER_RANGE);
+}
+
+// A string field read back from storage has to be terminated and long
+// enough, or empty where that is allowed
+inline bool storedStringValid(const char *field, size_t size,
+                              size_t minLength, bool emptyAllowed) {
+  const char *end = (const char *)memchr(field, '\0', size);
+  if (end == NULL) {
+    return false;
+  }
+  size_t length = end - field;
+  return (emptyAllowed && length == 0) || length >= minLength;
+}
+
+// The same checks /config applies, for a blob read back from storage
+inline bool configValid(const RobotConfig &config) {
+  for (int p = 0; p < NUM_PROFILES; p++) {
+    if (!profileValid(config.profiles[p])) {
+      return false;
+    }
+  }
+  return storedStringValid(config.token, sizeof(config.token),
+                           TOKEN_MIN_LENGTH, true) &&
+         storedStringValid(config.mqttBroker, sizeof(config.mqttBroker),
+                           BROKER_MIN_LENGTH, false) &&
+         inRange(config.activeProfile, ACTIVE_PROFILE_RANGE) &&
+         inRange(config.maxRetries, MAX_RETRIES_RANGE) &&
+         inRange(config.mqttRetryIntervalMs, MQTT_RETRY_INTERVAL_RANGE) &&
+         inRange(config.ackTurnaroundMs, ACK_TURNAROUND_RANGE) &&
+         inRange(config.retryBackoffMaxMs, RETRY_BACKOFF_RANGE) &&
+         inRange(config.maxWakeLatencyMs, WAKE_LATENCY_RANGE) &&
+         inRange(config.preCall.approachSpeedCmPerSec, APPROACH_SPEED_RANGE) &&
+         inRange(config.preCall.liftTravelPerFloorMs, LIFT_TRAVEL_RANGE) &&
+         inRange(config.preCall.liftDoorOpenMs, LIFT_DOOR_OPEN_RANGE) &&
+         inRange(config.preCall.marginMs, PRECALL_MARGIN_RANGE) &&
+         inRange(config.preCall.staleMs, APPROACH_STALE_RANGE) &&
+         powerSaveFits(config);
+}
+
+// Stored config if there is a valid one of this version, otherwise the
+// defaults. A corrupt blob would otherwise index past config.profiles.
+inline bool loadStoredConfig(ConfigStore &store, RobotConfig &config) {
+  RobotConfig stored;
+  if (store.read(stored) && stored.version == CONFIG_VERSION &&
+      configValid(stored)) {
+    config = stored;
+    return true;
+  }
+  config = DEFAULT_CONFIG;
+  return false;
+}
+
+#endif
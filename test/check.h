@@ -0,0 +1,23 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+// Minimal assertion helpers for the host tests
+
+#include <stdio.h>
+
+static int checkFailures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      checkFailures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+static int checkResult(const char *name) {
+  printf("%s: %s\n", name, checkFailures == 0 ? "PASS" : "FAIL");
+  return checkFailures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,251 @@
+// Tests of the runtime configuration in robot_config.h, with an in-memory
+// store standing in for NVS: loading, saving and checking a stored blob,
+// token provisioning and checking, the /config JSON parsing and the A/B
+// profile choice.
+
+#include "check.h"
+#include "robot_config.h"
+
+struct MemoryConfigStore : public ConfigStore {
+  bool stored;
+  RobotConfig blob;
+  int writes;
+
+  MemoryConfigStore() : stored(false), blob(), writes(0) {}
+  bool read(RobotConfig &config) {
+    if (!stored) {
+      return false;
+    }
+    config = blob;
+    return true;
+  }
+  bool write(const RobotConfig &config) {
+    stored = true;
+    blob = config;
+    writes++;
+    return true;
+  }
+};
+
+uint32_t counter = 0;
+uint32_t nextRandom() { return 0x9e3779b9u * ++counter; }
+
+void testStore() {
+  MemoryConfigStore store;
+  RobotConfig config;
+  CHECK(!loadStoredConfig(store, config));
+  CHECK(config.version == CONFIG_VERSION);
+  CHECK(config.activeProfile == DEFAULT_CONFIG.activeProfile);
+
+  config.maxRetries = 9;
+  config.profiles[1].sf = 7;
+  store.write(config);
+  RobotConfig loaded;
+  CHECK(loadStoredConfig(store, loaded));
+  CHECK(loaded.maxRetries == 9);
+  CHECK(loaded.profiles[1].sf == 7);
+
+  // A blob from another firmware version falls back to the defaults
+  store.blob.version = CONFIG_VERSION - 1;
+  CHECK(!loadStoredConfig(store, loaded));
+  CHECK(loaded.maxRetries == DEFAULT_CONFIG.maxRetries);
+
+  // So does a blob of the right size and version with a value /config
+  // would have refused, such as an activeProfile past config.profiles
+  RobotConfig corrupt[7];
+  for (RobotConfig &c : corrupt) {
+    c = config;
+  }
+  corrupt[0].activeProfile = 200;
+  corrupt[1].profiles[0].sf = 0;
+  corrupt[2].profiles[1].bw = NAN;
+  corrupt[3].maxRetries = -1;
+  corrupt[4].preCall.staleMs = 0;
+  memset(corrupt[5].token, 'x', sizeof(corrupt[5].token));
+  corrupt[6].mqttBroker[0] = '\0';
+  for (const RobotConfig &c : corrupt) {
+    store.write(c);
+    CHECK(!loadStoredConfig(store, loaded));
+    CHECK(loaded.activeProfile == DEFAULT_CONFIG.activeProfile);
+    CHECK(loaded.maxRetries == DEFAULT_CONFIG.maxRetries);
+  }
+  CHECK(configValid(DEFAULT_CONFIG));
+}
+
+void testToken() {
+  // Nothing shared ships in the defaults
+  CHECK(DEFAULT_CONFIG.token[0] == '\0');
+  RobotConfig config = DEFAULT_CONFIG;
+  CHECK(!tokenMatches(config, ""));
+  CHECK(!tokenMatches(config, "rmr-config"));
+
+  // First boot generates one, later boots keep it
+  MemoryConfigStore store;
+  loadStoredConfig(store, config);
+  CHECK(provisionToken(config, nextRandom));
+  CHECK(strlen(config.token) == 16);
+  store.write(config);
+  char first[sizeof(config.token)];
+  strcpy(first, config.token);
+
+  RobotConfig rebooted;
+  CHECK(loadStoredConfig(store, rebooted));
+  CHECK(!provisionToken(rebooted, nextRandom));
+  CHECK(strcmp(rebooted.token, first) == 0);
+  CHECK(tokenMatches(rebooted, first));
+
+  // Two devices don't end up with the same token
+  RobotConfig other = DEFAULT_CONFIG;
+  provisionToken(other, nextRandom);
+  CHECK(strcmp(other.token, first) != 0);
+
+  // Prefixes and extensions of the token are rejected
+  char longer[sizeof(first) + 1];
+  snprintf(longer, sizeof(longer), "%sx", first);
+  first[15] = '\0';
+  CHECK(!tokenMatches(rebooted, first));
+  CHECK(!tokenMatches(rebooted, longer));
+}
+
+void testJsonNumber() {
+  float value = -1;
+  CHECK(jsonNumber("{\"a\": 12.5}", "a", value) == JSON_OK && value == 12.5f);
+  CHECK(jsonNumber("{\"a\":-3, \"b\": 1}", "a", value) == JSON_OK &&
+        value == -3);
+  CHECK(jsonNumber("{\"a\": true}", "a", value) == JSON_OK && value == 1);
+  CHECK(jsonNumber("{\"a\": false }", "a", value) == JSON_OK && value == 0);
+  CHECK(jsonNumber("{\"b\": 1}", "a", value) == JSON_ABSENT);
+
+  // Anything that doesn't parse is rejected instead of read as 0
+  const char *bad[] = {
+      "{\"a\": \"7\"}", "{\"a\": abc}", "{\"a\": }",     "{\"a\": 1x}",
+      "{\"a\": -}",     "{\"a\": nan}", "{\"a\": inf}",  "{\"a\" 1}",
+      "{\"a\": truex}", "{\"a\": 1 2}", "{\"a\": null}",
+  };
+  for (const char *body : bad) {
+    CHECK(jsonNumber(body, "a", value) == JSON_INVALID);
+  }
+}
+
+void testJsonString() {
+  char value[8];
+  CHECK(jsonString("{\"s\": \"abc\"}", "s", value, sizeof(value)) == JSON_OK);
+  CHECK(strcmp(value, "abc") == 0);
+  CHECK(jsonString("{\"s\": \"\"}", "s", value, sizeof(value)) ==
+        JSON_INVALID);
+  CHECK(jsonString("{\"s\": \"12345678\"}", "s", value, sizeof(value)) ==
+        JSON_INVALID);
+  CHECK(jsonString("{\"s\": 5}", "s", value, sizeof(value)) == JSON_INVALID);
+  CHECK(jsonString("{\"s\": \"abc}", "s", value, sizeof(value)) ==
+        JSON_INVALID);
+  CHECK(jsonString("{}", "s", value, sizeof(value)) == JSON_ABSENT);
+}
+
+void testUpdateConfig() {
+  RobotConfig config = DEFAULT_CONFIG;
+  CHECK(updateConfig(config, "{\"maxRetries\": 8, \"abTest\": true, "
+                             "\"broker\": \"10.0.0.2\", \"token\": "
+                             "\"s3cret-token\"}"));
+  CHECK(config.maxRetries == 8);
+  CHECK(config.abTest);
+  CHECK(strcmp(config.mqttBroker, "10.0.0.2") == 0);
+  CHECK(strcmp(config.token, "s3cret-token") == 0);
+  CHECK(updateConfig(config, "{}"));
+
+  // The pre-call policy is tuned at runtime too
+  CHECK(config.preCallEnabled);
+  CHECK(updateConfig(config, "{\"preCallEnabled\": false, "
+                             "\"approachSpeedCmPerSec\": 25, "
+                             "\"liftTravelPerFloorMs\": 4000, "
+                             "\"preCallMarginMs\": 2000}"));
+  CHECK(!config.preCallEnabled);
+  CHECK(config.preCall.approachSpeedCmPerSec == 25);
+  CHECK(config.preCall.liftTravelPerFloorMs == 4000);
+  CHECK(config.preCall.marginMs == 2000);
+  CHECK(config.preCall.staleMs == DEFAULT_PRECALL_TUNING.staleMs);
+
+  // Out of range, fractional or non-numeric values are rejected, and the
+  // field is never written with a value its type can't hold
+  const char *bad[] = {
+      "{\"activeProfile\": 2}",   "{\"activeProfile\": -1}",
+      "{\"activeProfile\": 300}", "{\"activeProfile\": 0.5}",
+      "{\"maxRetries\": 21}",     "{\"maxRetries\": \"5\"}",
+      "{\"maxRetries\": five}",   "{\"abTest\": 2}",
+      "{\"ackTurnaroundMs\": -1}", "{\"retryBackoffMaxMs\": 0}",
+      "{\"mqttRetryIntervalMs\": 99}", "{\"maxWakeLatencyMs\": 1e9}",
+      "{\"token\": \"short\"}",   "{\"broker\": \"\"}",
+      "{\"approachSpeedCmPerSec\": 0}", "{\"liftTravelPerFloorMs\": 100}",
+      "{\"liftDoorOpenMs\": -5}",  "{\"approachStaleMs\": 70000}",
+  };
+  for (const char *body : bad) {
+    RobotConfig updated = config;
+    CHECK(!updateConfig(updated, body));
+    CHECK(updated.activeProfile == config.activeProfile);
+    CHECK(updated.maxRetries == config.maxRetries);
+    CHECK(updated.preCall.liftDoorOpenMs == config.preCall.liftDoorOpenMs);
+  }
+}
+
+void testUpdateProfile() {
+  RadioProfile profile = DEFAULT_CONFIG.profiles[0];
+  CHECK(updateProfile(profile, "{\"sf\": 7, \"bw\": 250, \"power\": -3}"));
+  CHECK(profile.sf == 7 && profile.bw == 250 && profile.power == -3);
+
+  const char *bad[] = {
+      "{\"sf\": 300}", "{\"sf\": 4}",    "{\"sf\": 7.5}",   "{\"cr\": 9}",
+      "{\"bw\": 0}",   "{\"bw\": 501}",  "{\"power\": 23}", "{\"power\": -200}",
+      "{\"freq\": 100}", "{\"freq\": x}",
+  };
+  for (const char *body : bad) {
+    RadioProfile updated = profile;
+    CHECK(!updateProfile(updated, body));
+    CHECK(updated.sf == profile.sf);
+    CHECK(updated.cr == profile.cr);
+    CHECK(updated.power == profile.power);
+  }
+}
+
+void testSameLink() {
+  // Only the settings both ends have to share count, TX power is local
+  RadioProfile profile = DEFAULT_CONFIG.profiles[0];
+  RadioProfile updated = profile;
+  CHECK(updateProfile(updated, "{\"power\": 2}"));
+  CHECK(sameLink(profile, updated));
+  const char *retunes[] = {
+      "{\"freq\": 915}", "{\"sf\": 7}", "{\"bw\": 250}", "{\"cr\": 8}",
+  };
+  for (const char *body : retunes) {
+    updated = profile;
+    CHECK(updateProfile(updated, body));
+    CHECK(!sameLink(profile, updated));
+  }
+}
+
+void testTripProfile() {
+  RobotConfig config = DEFAULT_CONFIG;
+  config.activeProfile = 1;
+  CHECK(tripProfile(config, 0) == 1);
+  CHECK(tripProfile(config, 5) == 1);
+  config.abTest = true;
+  CHECK(tripProfile(config, 0) == 1);
+  CHECK(tripProfile(config, 1) == 0);
+  CHECK(tripProfile(config, 2) == 1);
+  // Saving after any number of A/B trips stores what the operator set
+  MemoryConfigStore store;
+  store.write(config);
+  RobotConfig loaded;
+  loadStoredConfig(store, loaded);
+  CHECK(loaded.activeProfile == 1);
+}
+
+int main() {
+  testStore();
+  testToken();
+  testJsonNumber();
+  testJsonString();
+  testUpdateConfig();
+  testUpdateProfile();
+  testSameLink();
+  testTripProfile();
+  return checkResult("test_config");
+}
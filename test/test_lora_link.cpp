@@ -0,0 +1,399 @@
+// Tests of the LoRa duplicate suppression in lora_link.h.
+// A millisecond-stepped simulation runs the robot's callPanel() retry loop
+// against a panel that uses the same replay cache and frame order, over a
+// channel that drops, duplicates, delays and reorders frames and carries
+// traffic between other nodes. Reported: confirmation latency, retries and
+// how often the panel would have pressed a button twice. Reboots of either
+// end are checked separately.
+
+#include "check.h"
+#include "lora_link.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+const unsigned long AIRTIME_MS = 100;   // frame time on air
+const unsigned long TURNAROUND_MS = 50; // config ackTurnaroundMs
+const unsigned long BACKOFF_MAX_MS = 200;
+const int MAX_RETRIES = 3;
+const uint8_t OTHER_NODE_ID = 7;
+const uint32_t OTHER_TRAFFIC = 0xf0f0; // timestamp tag of injected frames
+
+struct InFlight {
+  unsigned long arrival;
+  Message frame;
+};
+
+struct Channel {
+  double lossRate;
+  double duplicateRate;
+  unsigned long jitterMs; // arrival spread, can push ACKs past the window
+  std::vector<InFlight> frames;
+
+  void send(const Message &frame, unsigned long now, std::mt19937 &rng) {
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_int_distribution<unsigned long> jitter(0, jitterMs);
+    if (chance(rng) < lossRate) {
+      return;
+    }
+    frames.push_back({now + AIRTIME_MS + jitter(rng), frame});
+    if (chance(rng) < duplicateRate) {
+      frames.push_back({now + 2 * AIRTIME_MS + jitter(rng), frame});
+    }
+  }
+
+  // Frames arriving at this millisecond
+  std::vector<Message> deliver(unsigned long now) {
+    std::vector<Message> arrived;
+    for (size_t i = 0; i < frames.size();) {
+      if (frames[i].arrival <= now) {
+        arrived.push_back(frames[i].frame);
+        frames.erase(frames.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    return arrived;
+  }
+};
+
+Message makeFrame(uint8_t type, uint8_t src, uint8_t dst, uint16_t boot,
+                  uint16_t seq) {
+  Message msg = {};
+  msg.ack = type;
+  msg.src = src;
+  msg.dst = dst;
+  msg.boot = boot;
+  msg.seqNum = seq;
+  return msg;
+}
+
+// Panel side: acts on each robot frame once, answers repeats from its cache
+struct Panel {
+  ReplayCache cache;
+  FrameOrder order;
+  std::map<uint32_t, int> actuations; // (boot, seqNum) -> button presses
+  int duplicates;
+  int stale;
+  int foreign;
+
+  void reset() {
+    cache = ReplayCache{};
+    order = FrameOrder{false, 0, 0};
+    actuations.clear();
+    duplicates = stale = foreign = 0;
+  }
+
+  // ACK to send back, or false if the frame is not answered
+  bool receive(const Message &frame, Message &reply) {
+    switch (classifyFrame(frame, PANEL_NODE_ID, ROBOT_NODE_ID, 0, 0)) {
+    case FRAME_FOREIGN:
+      foreign++;
+      return false;
+    case FRAME_DATA:
+      break;
+    default:
+      return false;
+    }
+    const Message *cached = cache.find(frame);
+    if (cached != NULL) {
+      duplicates++;
+      reply = *cached;
+      return true;
+    }
+    reply = makeAck(frame, PANEL_NODE_ID);
+    if (order.accept(frame)) {
+      actuations[(uint32_t)frame.boot << 16 | frame.seqNum]++;
+    } else {
+      stale++;
+    }
+    cache.store(frame, reply);
+    return true;
+  }
+};
+
+struct LinkStats {
+  int messages;
+  int confirmed;
+  int retries;
+  int lateAcks;
+  int robotForeign;
+  int otherTrafficHeard; // frames the robot heard between other nodes
+  std::vector<unsigned long> latencies;
+};
+
+struct LinkSim {
+  std::mt19937 rng;
+  Channel toPanel;
+  Channel toRobot;
+  Panel panel;
+  unsigned long now;
+  uint16_t robotBoot;
+  uint16_t robotSeq;
+  bool robotTransmitting;
+  bool acked;
+  LinkStats stats;
+
+  // Advance one millisecond: deliver frames, let the panel answer, inject
+  // traffic between other nodes
+  void step() {
+    now++;
+    std::uniform_real_distribution<double> chance(0, 1);
+    for (const Message &frame : toPanel.deliver(now)) {
+      Message reply;
+      if (panel.receive(frame, reply)) {
+        toRobot.send(reply, now, rng);
+      }
+    }
+    for (const Message &frame : toRobot.deliver(now)) {
+      if (robotTransmitting) {
+        continue; // half duplex, the robot's radio is busy
+      }
+      if (frame.timestamp == OTHER_TRAFFIC) {
+        stats.otherTrafficHeard++;
+      }
+      switch (classifyFrame(frame, ROBOT_NODE_ID, PANEL_NODE_ID, robotBoot,
+                            robotSeq)) {
+      case FRAME_ACK:
+        acked = true;
+        break;
+      case FRAME_LATE_ACK:
+        stats.lateAcks++;
+        break;
+      case FRAME_FOREIGN:
+        stats.robotForeign++;
+        break;
+      default:
+        break;
+      }
+    }
+    if (chance(rng) < 0.001) {
+      // Another robot calling the panel, and the panel answering it
+      Message call = makeFrame(MSG_REQUEST, OTHER_NODE_ID, PANEL_NODE_ID, 1, 1);
+      Message answer = makeFrame(MSG_ACK, PANEL_NODE_ID, OTHER_NODE_ID, 1, 1);
+      call.timestamp = answer.timestamp = OTHER_TRAFFIC;
+      toPanel.send(call, now, rng);
+      toRobot.send(answer, now, rng);
+    }
+  }
+
+  void wait(unsigned long ms) {
+    unsigned long end = now + ms;
+    while (now < end) {
+      step();
+    }
+  }
+
+  // robot1.cpp callPanel(): same seqNum on every retry
+  void callPanel() {
+    std::uniform_int_distribution<unsigned long> backoff(0, BACKOFF_MAX_MS);
+    robotSeq++;
+    acked = false;
+    stats.messages++;
+    unsigned long start = now;
+    for (int attempt = 0; attempt <= MAX_RETRIES; attempt++) {
+      toPanel.send(makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID,
+                             robotBoot, robotSeq),
+                   now, rng);
+      robotTransmitting = true;
+      wait(AIRTIME_MS);
+      robotTransmitting = false;
+      unsigned long windowEnd = now + AIRTIME_MS + TURNAROUND_MS;
+      while (now < windowEnd && !acked) {
+        step();
+      }
+      if (acked) {
+        stats.confirmed++;
+        stats.latencies.push_back(now - start);
+        return;
+      }
+      stats.retries++;
+      wait(backoff(rng));
+    }
+  }
+};
+
+void testLossyChannel() {
+  const int NUM_MESSAGES = 2000;
+  LinkSim sim;
+  sim.rng.seed(28);
+  sim.toPanel = Channel{0.2, 0.15, 40, {}};
+  sim.toRobot = Channel{0.2, 0.15, 40, {}};
+  sim.panel.reset();
+  sim.now = 0;
+  sim.robotBoot = 0x1234;
+  sim.robotSeq = 0;
+  sim.robotTransmitting = false;
+  sim.stats = LinkStats{0, 0, 0, 0, 0, 0, {}};
+
+  std::uniform_int_distribution<unsigned long> gap(0, 2000);
+  for (int i = 0; i < NUM_MESSAGES; i++) {
+    sim.callPanel();
+    sim.wait(gap(sim.rng));
+  }
+  sim.wait(2000);
+
+  LinkStats &stats = sim.stats;
+  int doubleActuations = 0;
+  int actuated = 0;
+  for (const auto &entry : sim.panel.actuations) {
+    actuated++;
+    if (entry.second > 1) {
+      doubleActuations += entry.second - 1;
+    }
+  }
+  std::vector<unsigned long> &lat = stats.latencies;
+  std::sort(lat.begin(), lat.end());
+  double mean = 0;
+  for (unsigned long l : lat) {
+    mean += l;
+  }
+  mean /= lat.size();
+  printf("messages %d, confirmed %d, actuated %d, retries %d\n",
+         stats.messages, stats.confirmed, actuated, stats.retries);
+  printf("latency ms mean %.0f, p95 %lu, max %lu\n", mean,
+         lat[lat.size() * 95 / 100], lat.back());
+  printf("panel duplicates %d, stale %d, double actuations %d\n",
+         sim.panel.duplicates, sim.panel.stale, doubleActuations);
+  printf("robot late ACKs %d, foreign %d\n", stats.lateAcks,
+         stats.robotForeign);
+
+  // Retries, duplicates and reordering never press a button twice
+  CHECK(doubleActuations == 0);
+  // Every confirmed message was acted on
+  CHECK(actuated >= stats.confirmed);
+  CHECK(stats.confirmed > NUM_MESSAGES * 9 / 10);
+  // The cached ACK path and the late ACK path were both exercised
+  CHECK(sim.panel.duplicates > 0);
+  CHECK(stats.lateAcks > 0);
+  // Late ACKs are duplicates, only traffic for other nodes is foreign
+  CHECK(stats.robotForeign == stats.otherTrafficHeard);
+  // One retry costs an ACK window plus the backoff
+  CHECK(mean < 2 * AIRTIME_MS + TURNAROUND_MS + BACKOFF_MAX_MS + 300);
+}
+
+// Frames delivered shuffled and repeated: every seqNum is acted on at most
+// once, and one older than the newest seen is only ACKed
+void testReorderedFrames() {
+  std::mt19937 rng(82);
+  for (int round = 0; round < 1000; round++) {
+    Panel panel;
+    panel.reset();
+    std::vector<Message> frames;
+    for (uint16_t seq = 1; seq <= 6; seq++) {
+      int copies = 1 + rng() % 3;
+      for (int i = 0; i < copies; i++) {
+        frames.push_back(makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID,
+                                   0x4242, seq));
+      }
+    }
+    std::shuffle(frames.begin(), frames.end(), rng);
+    Message reply;
+    uint16_t newest = 0;
+    int expectedStale = 0;
+    for (const Message &frame : frames) {
+      bool seen = panel.cache.find(frame) != NULL;
+      CHECK(panel.receive(frame, reply));
+      CHECK(reply.ack == MSG_ACK && reply.seqNum == frame.seqNum);
+      if (!seen && frame.seqNum < newest) {
+        expectedStale++;
+      }
+      if (!seen && frame.seqNum > newest) {
+        newest = frame.seqNum;
+      }
+    }
+    for (const auto &entry : panel.actuations) {
+      CHECK(entry.second == 1);
+    }
+    CHECK(panel.stale == expectedStale);
+    CHECK(panel.actuations.count(0x4242u << 16 | newest) == 1);
+  }
+}
+
+// Robot reboots, seqNum starts over at 1 while the panel still has the
+// previous boot's seq 1 cached
+void testRobotReboot() {
+  Panel panel;
+  panel.reset();
+  Message reply;
+  for (uint16_t seq = 1; seq <= 3; seq++) {
+    CHECK(panel.receive(makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID,
+                                  0xaaaa, seq),
+                        reply));
+  }
+  Message first = makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID, 0xbbbb, 1);
+  CHECK(panel.receive(first, reply));
+  CHECK(panel.actuations[0xbbbbu << 16 | 1] == 1);
+  CHECK(panel.duplicates == 0);
+  CHECK(panel.stale == 0);
+  // The ACK answers the new boot, so the robot accepts it
+  CHECK(classifyFrame(reply, ROBOT_NODE_ID, PANEL_NODE_ID, 0xbbbb, 1) ==
+        FRAME_ACK);
+  // A late ACK from before the reboot does not confirm the new seq 1
+  Message oldAck =
+      makeAck(makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID, 0xaaaa, 1),
+              PANEL_NODE_ID);
+  CHECK(classifyFrame(oldAck, ROBOT_NODE_ID, PANEL_NODE_ID, 0xbbbb, 1) ==
+        FRAME_LATE_ACK);
+
+  // Without a new boot id the same frame is answered from the cache
+  panel.reset();
+  Message frame = makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID, 0, 1);
+  panel.receive(frame, reply);
+  panel.receive(frame, reply);
+  CHECK(panel.actuations[1] == 1);
+  CHECK(panel.duplicates == 1);
+}
+
+// Panel reboots and its report seqNum starts over below the robot's last
+void testPanelReboot() {
+  ReplayCache cache = {};
+  FrameOrder order = {false, 0, 0};
+  for (uint16_t seq = 1; seq <= 500; seq++) {
+    Message report = makeFrame(MSG_LIFT_REPORT, PANEL_NODE_ID, ROBOT_NODE_ID,
+                               0x1111, seq);
+    CHECK(order.accept(report));
+    if (seq <= 2) {
+      cache.store(report, makeAck(report, ROBOT_NODE_ID));
+    }
+  }
+  // Out of order within one boot is stale
+  CHECK(!order.accept(
+      makeFrame(MSG_LIFT_REPORT, PANEL_NODE_ID, ROBOT_NODE_ID, 0x1111, 499)));
+
+  Message report =
+      makeFrame(MSG_LIFT_REPORT, PANEL_NODE_ID, ROBOT_NODE_ID, 0x2222, 1);
+  CHECK(cache.find(report) == NULL);
+  CHECK(order.accept(report));
+  CHECK(order.accept(
+      makeFrame(MSG_LIFT_REPORT, PANEL_NODE_ID, ROBOT_NODE_ID, 0x2222, 2)));
+}
+
+void testClassify() {
+  uint16_t boot = 0x5555;
+  CHECK(classifyFrame(makeFrame(MSG_REQUEST, ROBOT_NODE_ID, PANEL_NODE_ID,
+                                boot, 1),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_OWN);
+  CHECK(classifyFrame(makeFrame(MSG_ACK, OTHER_NODE_ID, ROBOT_NODE_ID, boot, 1),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_FOREIGN);
+  CHECK(classifyFrame(makeFrame(MSG_ACK, PANEL_NODE_ID, OTHER_NODE_ID, boot, 1),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_FOREIGN);
+  CHECK(classifyFrame(makeFrame(MSG_ACK, PANEL_NODE_ID, ROBOT_NODE_ID, boot, 1),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_ACK);
+  CHECK(classifyFrame(makeFrame(MSG_ACK, PANEL_NODE_ID, ROBOT_NODE_ID, boot, 0),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_LATE_ACK);
+  CHECK(classifyFrame(makeFrame(MSG_LIFT_REPORT, PANEL_NODE_ID,
+                                BROADCAST_NODE_ID, 9, 40),
+                      ROBOT_NODE_ID, PANEL_NODE_ID, boot, 1) == FRAME_DATA);
+}
+
+int main() {
+  testLossyChannel();
+  testReorderedFrames();
+  testRobotReboot();
+  testPanelReboot();
+  testClassify();
+  return checkResult("test_lora_link");
+}
@@ -0,0 +1,226 @@
+// Latency and energy model of the power save mode in power_model.h, using
+// the SX1262 airtime formula. Checks the airtime against reference values,
+// that the duty-cycle windows catch a long-preamble report at any arrival
+// phase within maxWakeLatencyMs, and that robot calls keep the short
+// preamble. Then simulates an hour of lift reports per profile and prints
+// the radio-on time against the added latency, and checks the firmware's
+// /metrics estimate of it. Past about a second the saving shrinks again:
+// once a window catches a report the receiver stays on for the rest of
+// its long preamble.
+
+#include "check.h"
+#include "lora_link.h"
+#include "power_model.h"
+#include "robot_config.h"
+
+#include <random>
+
+const float RX_CURRENT_MA = 4.6;     // SX1262 RX, DC-DC
+const float SLEEP_CURRENT_MA = 0.0012; // SX1262 sleep, warm start
+const unsigned long TURNAROUND_MS = 200; // config ackTurnaroundMs
+
+bool near(float a, float b, float tolerance) {
+  return fabsf(a - b) <= tolerance;
+}
+
+void testAirtime() {
+  // Semtech LoRa calculator values, CR 4/5, explicit header, CRC on
+  CHECK(near(loraAirtimeMs(7, 125, 5, 8, 10), 41.216, 0.01));
+  CHECK(near(loraAirtimeMs(9, 125, 5, 8, 13), 164.864, 0.01));
+  CHECK(near(loraAirtimeMs(12, 125, 5, 8, 10), 991.232, 0.01));
+  // The 13-byte Message at the default SF12 profile
+  CHECK(near(loraAirtimeMs(12, 125, 5, 8, sizeof(Message)), 1155.072, 0.01));
+  // Every extra preamble symbol costs one symbol time
+  CHECK(near(loraAirtimeMs(9, 125, 5, 108, 13) - loraAirtimeMs(9, 125, 5, 8, 13),
+             100 * loraSymbolMs(9, 125), 0.01));
+}
+
+// Time the duty-cycled receiver has seen RX_MIN_SYMBOLS of a preamble
+// starting at t0, or -1 if every window misses it
+float detectionTime(float t0, float preambleMs, float rxMs, float sleepMs,
+                    float symbolMs) {
+  float period = rxMs + sleepMs;
+  float needed = RX_MIN_SYMBOLS * symbolMs;
+  for (long k = (long)(t0 / period) - 1; k * period < t0 + preambleMs; k++) {
+    float start = k * period > t0 ? k * period : t0;
+    float end = k * period + rxMs < t0 + preambleMs ? k * period + rxMs
+                                                    : t0 + preambleMs;
+    if (end - start >= needed) {
+      return start + needed;
+    }
+  }
+  return -1;
+}
+
+struct Profile {
+  uint8_t sf;
+  float bw;
+};
+const Profile PROFILES[] = {{7, 125}, {9, 125}, {9, 250}, {12, 125}};
+const unsigned long WAKE_LATENCIES[] = {100, 500, 1000, 5000};
+
+void testDetection() {
+  std::mt19937 rng(30);
+  for (const Profile &p : PROFILES) {
+    float symbolMs = loraSymbolMs(p.sf, p.bw);
+    for (unsigned long maxWake : WAKE_LATENCIES) {
+      long preamble = wakePreambleSymbols(p.sf, p.bw, maxWake);
+      float rxMs;
+      float sleepMs;
+      if (!dutyCycleWindows(preamble, symbolMs, rxMs, sleepMs)) {
+        // Too slow a profile to sleep within this latency, stays in RX
+        continue;
+      }
+      std::uniform_real_distribution<float> phase(0, rxMs + sleepMs);
+      bool shortMissed = false;
+      for (int i = 0; i < 10000; i++) {
+        float t0 = phase(rng);
+        // Long report preamble: always caught
+        CHECK(detectionTime(t0, preamble * symbolMs, rxMs, sleepMs,
+                            symbolMs) >= 0);
+        // Short preamble: can fall into the sleep window
+        if (detectionTime(t0, DEFAULT_PREAMBLE * symbolMs, rxMs, sleepMs,
+                          symbolMs) < 0) {
+          shortMissed = true;
+        }
+      }
+      CHECK(shortMissed);
+      // Added latency: the longer report preamble, then at most one poll of
+      // the loop wait until the frame is read
+      float added = loraAirtimeMs(p.sf, p.bw, 5, preamble, sizeof(Message)) -
+                    loraAirtimeMs(p.sf, p.bw, 5, DEFAULT_PREAMBLE,
+                                  sizeof(Message)) +
+                    WAKE_POLL_MS;
+      CHECK(added <= maxWake);
+    }
+  }
+}
+
+// Robot calls and ACKs keep the short preamble, so a call takes as long as
+// with power save off
+void testCallLatency() {
+  printf("%-10s %9s %14s %16s\n", "profile", "wake ms", "call ack ms",
+         "long preamble");
+  for (const Profile &p : PROFILES) {
+    float shortAirtime =
+        loraAirtimeMs(p.sf, p.bw, 5, DEFAULT_PREAMBLE, sizeof(Message));
+    float call = 2 * shortAirtime + TURNAROUND_MS;
+    for (unsigned long maxWake : WAKE_LATENCIES) {
+      long preamble = wakePreambleSymbols(p.sf, p.bw, maxWake);
+      float longAirtime =
+          loraAirtimeMs(p.sf, p.bw, 5, preamble, sizeof(Message));
+      float longCall = 2 * longAirtime + TURNAROUND_MS;
+      printf("SF%-2d/%-5.0f %9lu %14.0f %16.0f\n", p.sf, p.bw, maxWake, call,
+             longCall);
+      CHECK(longCall - call >=
+            2 * (maxWake - WAKE_POLL_MS - loraSymbolMs(p.sf, p.bw)));
+    }
+  }
+}
+
+// One hour of lift reports at random times: radio-on share, and the report
+// latency added by the long preamble and the loop wait. Alongside, the
+// radio-on time the firmware accounts for /metrics: the duty share, plus
+// caughtFrameOnMs() for every caught report.
+void testEnergy() {
+  const float HOUR_MS = 3600000;
+  const float MEAN_REPORT_GAP_MS = 20000;
+  std::mt19937 rng(3600);
+  printf("%-10s %9s %9s %11s %12s %13s %10s\n", "profile", "wake ms",
+         "preamble", "rx duty %", "avg mA", "added ms", "metrics %");
+  for (const Profile &p : PROFILES) {
+    float symbolMs = loraSymbolMs(p.sf, p.bw);
+    float shortAirtime =
+        loraAirtimeMs(p.sf, p.bw, 5, DEFAULT_PREAMBLE, sizeof(Message));
+    for (unsigned long maxWake : WAKE_LATENCIES) {
+      long preamble = wakePreambleSymbols(p.sf, p.bw, maxWake);
+      float rxMs;
+      float sleepMs;
+      bool dutyCycled = dutyCycleWindows(preamble, symbolMs, rxMs, sleepMs);
+      float reportAirtime =
+          loraAirtimeMs(p.sf, p.bw, 5, preamble, sizeof(Message));
+
+      std::exponential_distribution<float> gap(1 / MEAN_REPORT_GAP_MS);
+      std::uniform_real_distribution<float> loopWait(0, WAKE_POLL_MS);
+      float fraction = dutyCycled ? rxMs / (rxMs + sleepMs) : 1;
+      float onMs = 0;
+      float accountedMs = 0;
+      float addedTotal = 0;
+      int reports = 0;
+      float now = 0;
+      while (true) {
+        float t0 = now + gap(rng);
+        if (t0 > HOUR_MS) {
+          break;
+        }
+        float heard = dutyCycled ? detectionTime(t0, preamble * symbolMs,
+                                                 rxMs, sleepMs, symbolMs)
+                                 : t0;
+        CHECK(heard >= 0);
+        // Fully on from detection to the end of our ACK
+        float received = t0 + reportAirtime;
+        float done = received + TURNAROUND_MS + shortAirtime;
+        onMs += done - heard;
+        onMs += (heard - now) * fraction;
+        // Firmware: duty share up to the end of the frame, topped up for the
+        // caught report, then fully on for our ACK
+        accountedMs += (received - now) * fraction + TURNAROUND_MS +
+                       shortAirtime;
+        if (dutyCycled) {
+          accountedMs +=
+              caughtFrameOnMs(reportAirtime, rxMs, sleepMs) * (1 - fraction);
+        }
+        addedTotal += reportAirtime - shortAirtime + loopWait(rng);
+        reports++;
+        now = done;
+      }
+      onMs += (HOUR_MS - now) * fraction;
+      accountedMs += (HOUR_MS - now) * fraction;
+
+      float duty = onMs / HOUR_MS;
+      float current = duty * RX_CURRENT_MA + (1 - duty) * SLEEP_CURRENT_MA;
+      float added = addedTotal / reports;
+      float metricsDuty = accountedMs / HOUR_MS;
+      printf("SF%-2d/%-5.0f %9lu %9ld %11.1f %12.3f %13.0f %10.1f\n", p.sf,
+             p.bw, maxWake, preamble, duty * 100, current, added,
+             metricsDuty * 100);
+
+      CHECK(added <= maxWake);
+      // /metrics radioOnMs follows the model
+      CHECK(fabsf(metricsDuty - duty) <= 0.1 * duty);
+      if (dutyCycled) {
+        CHECK(duty < 0.7);
+      }
+      // Default profile 1 (SF9) at the default 1000 ms saves most of it
+      if (p.sf == 9 && p.bw == 125 && maxWake == 1000) {
+        CHECK(duty < 0.15);
+      }
+    }
+  }
+}
+
+// The 16-bit preamble register: fast profiles with long latencies are
+// rejected instead of wrapping around
+void testPreambleLimit() {
+  CHECK(wakePreambleSymbols(5, 500, 10000) > MAX_PREAMBLE_SYMBOLS);
+  RobotConfig config = DEFAULT_CONFIG;
+  config.powerSave = true;
+  config.maxWakeLatencyMs = 10000;
+  CHECK(powerSaveFits(config));
+  CHECK(updateProfile(config.profiles[1], "{\"sf\": 5, \"bw\": 500}"));
+  CHECK(!powerSaveFits(config));
+  config.maxWakeLatencyMs = 4000;
+  CHECK(powerSaveFits(config));
+  config.maxWakeLatencyMs = 10000;
+  config.powerSave = false;
+  CHECK(powerSaveFits(config));
+}
+
+int main() {
+  testAirtime();
+  testDetection();
+  testCallLatency();
+  testEnergy();
+  testPreambleLimit();
+  return checkResult("test_power_model");
+}
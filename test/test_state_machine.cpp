@@ -0,0 +1,417 @@
+// Randomized tests of the lift cycle state machine in lift_state_machine.h.
+// The firmware side runs robot1.cpp's loop order on the shared table,
+// notice, retry, timeout and GPIO functions. The world side runs one trip
+// per iteration: the robot and the lift move in physical order, but their
+// reports travel over MQTT and LoRa with random delays, duplicates and
+// drops, and the Pi's GPIO line follows detection.py (HIGH with any tag
+// within 4 m, dropping out on the approach and while driving in), so the
+// firmware sees thousands of different interleavings.
+
+#include "check.h"
+#include "lift_state_machine.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+const unsigned long LOOP_PERIOD_MS = 100;     // robot1.cpp loop()
+const unsigned long MQTT_REPEAT_MS = 500;     // gui.py update_value()
+const unsigned long TRIP_LIMIT_MS = 600000;
+
+const unsigned long NEVER = (unsigned long)-1;
+
+// robot1.cpp's globals and loop steps, without the radio and display
+struct Firmware {
+  RobotStatus state;
+  EventQueue queue;
+  int pending;
+  unsigned long enteredAt;
+  bool timeoutPosted;
+  bool robotAtRwz;
+  bool lastPin;
+  unsigned long visitedAt[NUM_STATUSES]; // first entry this trip
+  int droppedEvents;
+  int enteredRetries;
+  int pinEntries;
+
+  void reset() {
+    state = IDLE;
+    queue = EventQueue{{}, 0, 0};
+    pending = NO_NOTICE;
+    enteredAt = 0;
+    timeoutPosted = false;
+    robotAtRwz = false;
+    lastPin = false;
+    std::fill(visitedAt, visitedAt + NUM_STATUSES, NEVER);
+    visitedAt[IDLE] = 0;
+    droppedEvents = 0;
+    enteredRetries = 0;
+    pinEntries = 0;
+  }
+
+  bool visited(RobotStatus status) const { return visitedAt[status] != NEVER; }
+
+  // enterState()
+  void enter(RobotStatus next, unsigned long now) {
+    state = next;
+    enteredAt = now;
+    timeoutPosted = false;
+    if (visitedAt[next] == NEVER) {
+      visitedAt[next] = now;
+    }
+    if (next == IDLE) {
+      robotAtRwz = false;
+    }
+    pending = noticeOnEntry(next, pending);
+  }
+
+  void post(RobotEvent event) {
+    if (!queue.push(event)) {
+      droppedEvents++;
+    }
+  }
+
+  // mqttCallback()
+  void mqtt(RobotEvent event) {
+    if (event == EV_ROBOT_AT_RWZ) {
+      robotAtRwz = true;
+    }
+    post(event);
+  }
+
+  // processEvents()
+  void process(unsigned long now) {
+    RobotEvent event;
+    while (queue.pop(event)) {
+      RobotStatus next;
+      if (findTransition(state, event, next)) {
+        if (event == EV_TAG_REACQUIRED) {
+          pinEntries++;
+        }
+        enter(next, now);
+      }
+    }
+  }
+
+  // pollRobotPin()
+  void pollPin(bool high) {
+    if (high == lastPin) {
+      return;
+    }
+    lastPin = high;
+    RobotEvent event;
+    if (pinEvent(high, robotAtRwz, event)) {
+      post(event);
+    }
+  }
+
+  // checkStateTimeout()
+  void checkTimeout(unsigned long now) {
+    if (!timeoutPosted && stateTimedOut(state, now - enteredAt)) {
+      timeoutPosted = true;
+      post(EV_TIMEOUT);
+    }
+  }
+
+  // serviceRadio(), acked = callPanel() result after its own LoRa retries
+  void serviceRadio(bool acked) {
+    if (pending == NO_NOTICE) {
+      return;
+    }
+    int type = pending;
+    pending = NO_NOTICE;
+    switch (noticeOutcome(state, acked)) {
+    case NOTICE_ACKED:
+      post(EV_PANEL_ACKED);
+      break;
+    case NOTICE_RETRY:
+      if (type == MSG_ROBOT_ENTERED) {
+        enteredRetries++;
+      }
+      pending = type;
+      break;
+    case NOTICE_FAILED:
+      post(EV_PANEL_FAILED);
+      break;
+    }
+  }
+};
+
+// detection.py's LED line over a trip: off until a tag is within 4 m,
+// with dropouts of a few frames while far away and while driving in
+struct PinTrace {
+  std::vector<std::pair<unsigned long, unsigned long>> low; // [from, to)
+  unsigned long nearAt;
+  unsigned long offAt;
+
+  bool high(unsigned long now) const {
+    if (now < nearAt || now >= offAt) {
+      return false;
+    }
+    for (const auto &gap : low) {
+      if (now >= gap.first && now < gap.second) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+struct Delivery {
+  unsigned long time;
+  RobotEvent event;
+  bool operator<(const Delivery &o) const { return time < o.time; }
+};
+
+struct TripStats {
+  int trips;
+  int callFailures;
+  int reportsDropped;
+  int enteredRetries;
+  int pinEntries;
+};
+
+// Physical times of one trip, NEVER until the world gets there
+struct WorldTimes {
+  unsigned long pickup;
+  unsigned long entered;
+  unsigned long target;
+  unsigned long exited;
+};
+
+// One trip from floor request back to IDLE. Returns false if it never got
+// back to IDLE.
+bool runTrip(Firmware &fw, std::mt19937 &rng, double panelAckRate,
+             TripStats &stats, WorldTimes &world) {
+  std::uniform_real_distribution<double> chance(0, 1);
+  std::uniform_int_distribution<int> mqttDelay(0, 300);
+  std::uniform_int_distribution<int> loraDelay(0, 2500);
+  std::uniform_int_distribution<int> repeats(1, 3);
+  auto between = [&](int lo, int hi) {
+    return (unsigned long)std::uniform_int_distribution<int>(lo, hi)(rng);
+  };
+
+  fw.reset();
+  std::vector<Delivery> deliveries;
+  auto mqtt = [&](unsigned long at, RobotEvent event) {
+    // gui.py republishes the state every tick while it holds
+    int n = repeats(rng);
+    for (int i = 0; i < n; i++) {
+      deliveries.push_back({at + i * MQTT_REPEAT_MS + mqttDelay(rng), event});
+    }
+  };
+  auto lora = [&](unsigned long at, RobotEvent event, double dropRate) {
+    if (chance(rng) < dropRate) {
+      stats.reportsDropped++;
+      return;
+    }
+    deliveries.push_back({at + loraDelay(rng), event});
+    // Panel re-sends the report when it misses our ACK
+    if (chance(rng) < 0.2) {
+      deliveries.push_back({at + loraDelay(rng) + 1200, event});
+    }
+  };
+
+  unsigned long callDueAt = between(0, 20000);
+  unsigned long robotAtRwz = between(0, 20000);
+  mqtt(robotAtRwz, EV_ROBOT_AT_RWZ);
+  bool worldStarted = false;
+  world = WorldTimes{NEVER, NEVER, NEVER, NEVER};
+
+  // Tag within 4 m some seconds before the waiting zone; the robot may
+  // already be that close at the floor request
+  PinTrace pin;
+  pin.nearAt = robotAtRwz > 15000 ? robotAtRwz - between(5000, 15000) : 0;
+  pin.offAt = NEVER;
+  // The last second before stopping at the waiting zone, and while standing
+  // there, the tag is close and stays in view
+  for (int i = between(0, 3); i > 0 && robotAtRwz > pin.nearAt + 1300; i--) {
+    unsigned long from = between(pin.nearAt, robotAtRwz - 1300);
+    pin.low.push_back({from, from + between(300, 1000)});
+  }
+
+  fw.post(EV_FLOOR_REQUEST);
+  fw.process(0);
+  for (unsigned long now = 0; now < TRIP_LIMIT_MS; now += LOOP_PERIOD_MS) {
+    // Lift starts moving once the panel has the call
+    if (!worldStarted && fw.state == ELEVATOR_CONFIRMED) {
+      worldStarted = true;
+      unsigned long pickup = now + between(0, 15000);
+      unsigned long entered = std::max(pickup, robotAtRwz) + between(500, 5000);
+      unsigned long moving = entered + between(500, 4000);
+      unsigned long target = moving + between(3000, 20000);
+      unsigned long exited = target + between(1000, 8000);
+      lora(pickup, EV_LIFT_AT_PICKUP, 0.2);
+      mqtt(entered, EV_ROBOT_ENTERED);
+      lora(moving, EV_LIFT_MOVING, 0.2);
+      lora(target, EV_LIFT_AT_TARGET, 0.05);
+      mqtt(exited, EV_ROBOT_EXITED);
+      world = WorldTimes{pickup, entered, target, exited};
+
+      // Driving in: the entrance tag leaves the view, the one in the car
+      // comes in by the time the robot is inside. Mid-ride dropouts, and
+      // out of range some time after exiting.
+      if (chance(rng) < 0.5) {
+        pin.low.push_back({entered - between(200, 500), entered});
+      }
+      for (int i = between(0, 3); i > 0; i--) {
+        unsigned long from = between(entered, exited);
+        pin.low.push_back({from, from + between(300, 1500)});
+      }
+      pin.offAt = exited + between(1000, 8000);
+    }
+
+    std::stable_sort(deliveries.begin(), deliveries.end());
+    while (!deliveries.empty() && deliveries.front().time <= now) {
+      RobotEvent event = deliveries.front().event;
+      if (event == EV_ROBOT_AT_RWZ || event == EV_ROBOT_ENTERED ||
+          event == EV_ROBOT_EXITED) {
+        fw.mqtt(event);
+      } else {
+        fw.post(event);
+      }
+      deliveries.erase(deliveries.begin());
+    }
+    fw.pollPin(pin.high(now));
+    if (fw.state == FLOOR_REQUEST_SUCCESS && now >= callDueAt) {
+      fw.post(EV_CALL_DUE);
+    }
+    fw.checkTimeout(now);
+    fw.process(now);
+    fw.serviceRadio(chance(rng) < panelAckRate);
+    fw.process(now);
+
+    if (fw.state == IDLE && now > 0 && deliveries.empty()) {
+      stats.trips++;
+      stats.enteredRetries += fw.enteredRetries;
+      stats.pinEntries += fw.pinEntries;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Random trips with lossy reports and a flaky panel
+void testRandomTrips() {
+  const int NUM_TRIPS = 5000;
+  std::mt19937 rng(27);
+  TripStats stats = {0, 0, 0, 0, 0};
+  Firmware fw;
+  WorldTimes world;
+
+  for (int i = 0; i < NUM_TRIPS; i++) {
+    bool finished = runTrip(fw, rng, 0.7, stats, world);
+    CHECK(finished);
+    CHECK(fw.droppedEvents == 0);
+    bool callAcked = fw.visited(ELEVATOR_CONFIRMED);
+    if (callAcked) {
+      // Once the lift is called, lost reports and failed notices never end
+      // the trip early: the robot always gets in and out
+      CHECK(!fw.visited(COMMUNICATION_ERROR));
+      CHECK(fw.visited(ROBOT_IN));
+      CHECK(fw.visited(ROBOT_OUT));
+      // The panel is never told the robot is in before it is, or out while
+      // it is still riding, whatever the GPIO line does on the approach
+      CHECK(fw.visitedAt[ROBOT_IN] >= world.entered);
+      CHECK(fw.visitedAt[ROBOT_OUT] >= world.exited);
+    } else {
+      stats.callFailures++;
+      CHECK(fw.visited(COMMUNICATION_ERROR));
+    }
+  }
+
+  printf("trips %d, call failures %d, reports dropped %d, entered retries %d, "
+         "entries from GPIO %d\n",
+         stats.trips, stats.callFailures, stats.reportsDropped,
+         stats.enteredRetries, stats.pinEntries);
+  CHECK(stats.trips == NUM_TRIPS);
+  // The retry path, the failure path and the GPIO entry were all exercised
+  CHECK(stats.enteredRetries > 0);
+  CHECK(stats.callFailures > 0);
+  CHECK(stats.pinEntries > 0);
+}
+
+// From every state, timeouts alone bring the machine back to IDLE even if
+// the panel never answers
+void testTimeoutsAlwaysReachIdle() {
+  Firmware fw;
+  for (int s = 0; s < NUM_STATUSES; s++) {
+    fw.reset();
+    fw.enter((RobotStatus)s, 0);
+    unsigned long now = 0;
+    for (; now < TRIP_LIMIT_MS && !(now > 0 && fw.state == IDLE);
+         now += LOOP_PERIOD_MS) {
+      fw.checkTimeout(now);
+      fw.process(now);
+      fw.serviceRadio(false);
+      fw.process(now);
+    }
+    CHECK(fw.state == IDLE);
+  }
+}
+
+// Random event sequences: a failed panel notice never ends a ride, and
+// ignored events never change the state
+void testRandomEventSequences() {
+  std::mt19937 rng(2027);
+  std::uniform_int_distribution<int> eventDist(0, NUM_EVENTS - 1);
+  std::uniform_int_distribution<int> stateDist(0, NUM_STATUSES - 1);
+  for (int i = 0; i < 10000; i++) {
+    RobotStatus state = (RobotStatus)stateDist(rng);
+    for (int j = 0; j < 50; j++) {
+      RobotEvent event = (RobotEvent)eventDist(rng);
+      RobotStatus next = state;
+      bool handled = findTransition(state, event, next);
+      if (!handled) {
+        CHECK(next == state);
+      }
+      if (event == EV_PANEL_FAILED &&
+          (state == ROBOT_IN || state == TRAVELLING ||
+           state == ELEVATOR_AT_TARGET)) {
+        CHECK(!handled);
+      }
+      CHECK(next >= IDLE && next < NUM_STATUSES);
+      state = next;
+    }
+  }
+}
+
+void testEventQueue() {
+  EventQueue queue = {{}, 0, 0};
+  RobotEvent event = EV_TIMEOUT;
+  CHECK(!queue.pop(event));
+
+  // One slot stays free
+  for (int i = 0; i < EVENT_QUEUE_SIZE - 1; i++) {
+    CHECK(queue.push((RobotEvent)(i % NUM_EVENTS)));
+  }
+  CHECK(!queue.push(EV_TIMEOUT));
+  for (int i = 0; i < EVENT_QUEUE_SIZE - 1; i++) {
+    CHECK(queue.pop(event));
+    CHECK(event == (RobotEvent)(i % NUM_EVENTS));
+  }
+  CHECK(!queue.pop(event));
+
+  // FIFO order survives many wrap-arounds
+  std::mt19937 rng(16);
+  std::vector<RobotEvent> expected;
+  for (int i = 0; i < 10000; i++) {
+    if (rng() % 2 && (int)expected.size() < EVENT_QUEUE_SIZE - 1) {
+      RobotEvent e = (RobotEvent)(rng() % NUM_EVENTS);
+      CHECK(queue.push(e));
+      expected.push_back(e);
+    } else if (!expected.empty()) {
+      CHECK(queue.pop(event));
+      CHECK(event == expected.front());
+      expected.erase(expected.begin());
+    }
+  }
+}
+
+int main() {
+  testRandomTrips();
+  testTimeoutsAlwaysReachIdle();
+  testRandomEventSequences();
+  testEventQueue();
+  return checkResult("test_state_machine");
+}